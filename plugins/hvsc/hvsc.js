@@ -16,9 +16,10 @@
 	return content.slice(s);
     };
 
-    function scrape_page(doc, limit)
+    function scrape_page(doc, offset, limit)
     {
 	var result = [];
+	var cnt = 0;
 
 	while(1 && limit != 0)
 	{
@@ -36,6 +37,10 @@
 	    // sid id
 	    var str = getValue(doc, "(", ")");
 	    if (str == null) break;
+	    cnt++;
+
+	    if (offset >= cnt) continue;
+
 	    item.uri = constants.base_uri + "/siddownload.htm?id=" + str;
 
 	    // title
@@ -64,10 +69,10 @@
 	return result;
     };
 
-    plugin.search(function(keywords, limit) {
+    plugin.search(function(keywords, limit, options) {
 	var res = http.get(constants.base_uri + "/dosearch.htm?searchQuery=" + keywords.join("+"));
 	if (res.status != 200) return [];
-	return scrape_page(res.body, limit);
-    });
+	return scrape_page(res.body, options.offset, limit);
+    }, [plugin.item.TYPE_MUSIC_TRACK]);
 
 }) (this);
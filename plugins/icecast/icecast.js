@@ -149,9 +149,9 @@
 	return get_items(uri, offset, limit);
     });
 
-    plugin.search(function(keywords, limit) {
+    plugin.search(function(keywords, limit, options) {
 	var res = http.get(constants.base_uri + "/search?search=" + keywords.join("+"));
-	return scrape_page(res.body, 0, limit);
-    });
+	return scrape_page(res.body, options.offset, limit);
+    }, [plugin.item.TYPE_RADIO_STATION]);
 
 }) (this);
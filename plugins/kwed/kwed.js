@@ -99,11 +99,11 @@
 	return result;
     }
 
-    plugin.search(function(keywords, limit) {
+    plugin.search(function(keywords, limit, options) {
 	var res = http.get(constants.base_uri + "/index.php?search=" + keywords.join("+"));
 	if (res.status != 200) return [];
-	return scrape_page(res.body, 0, limit);
-    });
+	return scrape_page(res.body, options.offset, limit);
+    }, [plugin.item.TYPE_MUSIC_TRACK]);
 
     plugin.register("/", function(offset, limit) {
 	var result = [];
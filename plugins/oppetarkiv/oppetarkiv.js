@@ -56,15 +56,17 @@
     /*
      * Implementation of search function
      */
-    plugin.search(function(keywords, limit) {
+    plugin.search(function(keywords, limit, options) {
 
 	var result = query("/search/videos", {
 	    'q': keywords.join("+"),
+	    'page': Math.floor(options.offset / limit),
+	    'count': limit,
 	    'pretty': true
 	});
 	// TODO: process search result into list
 	return []
-    });
+    }, [plugin.item.TYPE_VIDEO]);
 
     plugin.register('/recommended', function(offset, limit) {
 	var result = [];
@@ -79,16 +79,16 @@
 	return result;
     }
 
-    plugin.search(function(keywords, limit) {
+    plugin.search(function(keywords, limit, options) {
 	var result = [];
 	var data = get_data("/index/searchembeddedbroadcast", {
 	    'q': keywords.join("+"),
-	    'start': 0,
+	    'start': options.offset,
 	    'rows': limit
 	});
 
 	return parse_stations(data);
-    });
+    }, [plugin.item.TYPE_RADIO_STATION]);
 
     plugin.register("/", function(offset, limit) {
 	var result = [];
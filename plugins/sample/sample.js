@@ -11,8 +11,8 @@
     /*
      * Implementation of search function
      */
-    plugin.search(function(keywords, limit) {
-	return ["test1", "test2"]
+    plugin.search(function(keywords, limit, options) {
+	return ["test1", "test2"].slice(options.offset, options.offset + limit);
     });
 
     plugin.register("/items", function(offset, limit) {
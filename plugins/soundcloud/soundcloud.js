@@ -192,9 +192,9 @@
 	return result;
     });
 
-    plugin.search(function(keywords, limit) {
+    plugin.search(function(keywords, limit, options) {
 	var result = [];
-	var tracks = sc.searchTracks(keywords, 0, limit);
+	var tracks = sc.searchTracks(keywords, options.offset, limit);
 
 	tracks.collection.forEach(function(track) {
 
@@ -215,6 +215,6 @@
 	});
 
 	return result;
-    });
+    }, [plugin.item.TYPE_MUSIC_TRACK]);
 
 }) (this);
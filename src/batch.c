@@ -0,0 +1,566 @@
+/*
+ * This file is part of cast.io
+ *
+ * Copyright 2014 Henrik Andersson <henrik.4e@gmail.com>
+ *
+ * cast.io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cast.io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cast.io.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+
+#include "batch.h"
+#include "service.h"
+#include "response.h"
+
+#define DOMAIN "batch"
+
+/* maximum number of sub-requests of a batch */
+#define BATCH_MAX_REQUESTS 64
+
+/* maximum number of sub-requests dispatched concurrently */
+#define BATCH_MAX_CONNECTIONS 16
+
+/* header carrying the token of a sub-request */
+#define BATCH_TOKEN_HEADER "X-Castio-Batch"
+
+/* data of a request received on the loopback interface */
+#define BATCH_LOOPBACK_KEY "castio-batch-loopback"
+
+typedef struct cio_batch_t
+{
+  cio_service_t *service;
+  SoupSession *session;
+  gchar token[33];
+} cio_batch_t;
+
+/* a batch request waiting for its sub-requests */
+typedef struct _batch_job_t
+{
+  SoupServer *server;
+  SoupMessage *msg;
+  GPtrArray *results;
+  guint pending;
+  gboolean stream;
+  gboolean pretty;
+} _batch_job_t;
+
+typedef struct _batch_request_t
+{
+  _batch_job_t *job;
+  guint index;
+  gchar *path;
+} _batch_request_t;
+
+/** create the result object of a finished sub-request */
+static JsonObject *
+_batch_result(_batch_request_t *request, SoupMessage *sub)
+{
+  gchar *data;
+  const gchar *mime;
+  JsonObject *result;
+  JsonParser *parser;
+  SoupBuffer *body;
+
+  result = json_object_new();
+  json_object_set_string_member(result, "path", request->path);
+  json_object_set_int_member(result, "status", sub->status_code);
+
+  if (sub->response_body == NULL || sub->response_body->length == 0)
+    return result;
+
+  body = soup_message_body_flatten(sub->response_body);
+  mime = soup_message_headers_get_content_type(sub->response_headers, NULL);
+
+  /* embed a json body as is, other content as base64 */
+  if (mime && g_str_has_prefix(mime, "application/json"))
+  {
+    parser = json_parser_new();
+    if (json_parser_load_from_data(parser, body->data, body->length, NULL))
+      json_object_set_member(result, "body",
+			     json_node_copy(json_parser_get_root(parser)));
+    g_object_unref(parser);
+  }
+  else
+  {
+    data = g_base64_encode((const guchar *)body->data, body->length);
+    json_object_set_string_member(result, "content_type", mime ? mime : "");
+    json_object_set_string_member(result, "data", data);
+    g_free(data);
+  }
+
+  soup_buffer_free(body);
+  return result;
+}
+
+static void
+_batch_result_free(gpointer data)
+{
+  /* results of a batch whose client is gone are never set */
+  if (data)
+    json_object_unref((JsonObject *)data);
+}
+
+/** write a result as one line of a streamed batch response */
+static void
+_batch_job_stream_write(_batch_job_t *job, JsonObject *result)
+{
+  gsize length;
+  gchar *content;
+  gchar *chunk;
+  JsonNode *node;
+  JsonGenerator *gen;
+
+  node = json_node_alloc();
+  json_node_init_object(node, result);
+
+  gen = json_generator_new();
+  json_generator_set_root(gen, node);
+  content = json_generator_to_data(gen, &length);
+  g_object_unref(gen);
+  json_node_free(node);
+
+  chunk = g_strdup_printf("%s\n", content);
+  g_free(content);
+
+  soup_message_body_append(job->msg->response_body, SOUP_MEMORY_TAKE,
+			   chunk, strlen(chunk));
+  soup_server_unpause_message(job->server, job->msg);
+}
+
+/** add result of sub-request at index to the response */
+static void
+_batch_job_add(_batch_job_t *job, guint index, JsonObject *result)
+{
+  if (job->stream)
+  {
+    json_object_set_int_member(result, "index", index);
+    _batch_job_stream_write(job, result);
+    json_object_unref(result);
+  }
+  else
+    job->results->pdata[index] = result;
+}
+
+static void
+_batch_job_finished(SoupMessage *msg, gpointer user_data)
+{
+  _batch_job_t *job;
+  job = (_batch_job_t *)user_data;
+
+  /* client is gone, sub-requests still running are dropped */
+  job->msg = NULL;
+}
+
+/** answer the batch request when all sub-requests are finished */
+static void
+_batch_job_complete(_batch_job_t *job)
+{
+  guint i;
+  JsonNode *node;
+  JsonArray *array;
+
+  if (job->msg)
+  {
+    g_signal_handlers_disconnect_by_data(job->msg, job);
+
+    if (job->stream)
+      soup_message_body_complete(job->msg->response_body);
+    else
+    {
+      /* results in the order of the sub-requests */
+      array = json_array_new();
+      for (i = 0; i < job->results->len; i++)
+	json_array_add_object_element(array, json_object_ref(g_ptr_array_index(job->results, i)));
+
+      node = json_node_alloc();
+      json_node_init_array(node, array);
+      json_array_unref(array);
+      cio_response_json(job->server, job->msg, node, job->pretty);
+      soup_message_set_status(job->msg, SOUP_STATUS_OK);
+    }
+
+    soup_server_unpause_message(job->server, job->msg);
+  }
+
+  g_ptr_array_free(job->results, TRUE);
+  g_free(job);
+}
+
+static void
+_batch_request_done(SoupSession *session, SoupMessage *sub, gpointer user_data)
+{
+  _batch_job_t *job;
+  _batch_request_t *request;
+
+  request = (_batch_request_t *)user_data;
+  job = request->job;
+
+  if (job->msg)
+    _batch_job_add(job, request->index, _batch_result(request, sub));
+
+  g_free(request->path);
+  g_free(request);
+
+  if (--job->pending == 0)
+    _batch_job_complete(job);
+}
+
+/** create the uri the server is reached at, NULL if not listening */
+static SoupURI *
+_batch_base_uri(SoupServer *server)
+{
+  gchar *host;
+  GSList *uris;
+  SoupURI *base;
+  GInetAddress *address;
+  GInetAddress *loopback;
+
+  uris = soup_server_get_uris(server);
+  if (uris == NULL)
+    return NULL;
+
+  base = soup_uri_copy((SoupURI *)uris->data);
+  g_slist_free_full(uris, (GDestroyNotify)soup_uri_free);
+
+  /* a server listening on any address is reached on loopback */
+  address = g_inet_address_new_from_string(base->host);
+  if (address && g_inet_address_get_is_any(address))
+  {
+    loopback = g_inet_address_new_loopback(g_inet_address_get_family(address));
+    host = g_inet_address_to_string(loopback);
+    soup_uri_set_host(base, host);
+    g_free(host);
+    g_object_unref(loopback);
+  }
+
+  if (address)
+    g_object_unref(address);
+
+  return base;
+}
+
+/** check that the normalized path of a sub-request is not a batch */
+static gboolean
+_batch_request_path_valid(SoupURI *uri)
+{
+  gint i;
+  gboolean valid;
+  gchar *path;
+  gchar **segments;
+
+  path = soup_uri_decode(soup_uri_get_path(uri));
+  valid = !g_str_has_prefix(path, "/batch");
+
+  /* dot segments which only show up after decoding */
+  segments = g_strsplit(path, "/", -1);
+  for (i = 0; valid && segments[i]; i++)
+    if (strcmp(segments[i], ".") == 0 || strcmp(segments[i], "..") == 0)
+      valid = FALSE;
+
+  g_strfreev(segments);
+  g_free(path);
+  return valid;
+}
+
+/** create the sub-request of a batch entry, NULL if invalid */
+static SoupMessage *
+_batch_request_new(cio_batch_t *self, SoupURI *base,
+		   JsonNode *entry, const gchar **path)
+{
+  gchar *content;
+  gsize length;
+  const gchar *method;
+  JsonObject *object;
+  JsonNode *body;
+  JsonGenerator *gen;
+  SoupMessage *sub;
+  SoupURI *uri;
+
+  *path = NULL;
+  if (!JSON_NODE_HOLDS_OBJECT(entry))
+    return NULL;
+
+  object = json_node_get_object(entry);
+  if (!json_object_has_member(object, "path"))
+    return NULL;
+
+  /* an absolute path, a leading // would address another host */
+  *path = json_object_get_string_member(object, "path");
+  if (base == NULL || *path == NULL || (*path)[0] != '/' || (*path)[1] == '/')
+    return NULL;
+
+  method = SOUP_METHOD_GET;
+  if (json_object_has_member(object, "method")
+      && g_strcmp0(json_object_get_string_member(object, "method"), "PUT") == 0)
+    method = SOUP_METHOD_PUT;
+
+  /* dispatch sub-request to the handlers of this service, resolving
+     the path removes its dot segments */
+  uri = soup_uri_new_with_base(base, *path);
+  if (uri == NULL)
+    return NULL;
+
+  sub = NULL;
+  if (_batch_request_path_valid(uri))
+    sub = soup_message_new_from_uri(method, uri);
+  soup_uri_free(uri);
+
+  if (sub == NULL)
+    return NULL;
+
+  soup_message_headers_append(sub->request_headers, BATCH_TOKEN_HEADER, self->token);
+
+  body = json_object_get_member(object, "body");
+  if (method == SOUP_METHOD_PUT && body)
+  {
+    gen = json_generator_new();
+    json_generator_set_root(gen, body);
+    content = json_generator_to_data(gen, &length);
+    g_object_unref(gen);
+
+    soup_message_set_request(sub, "application/json; charset=utf-8",
+			     SOUP_MEMORY_TAKE, content, length);
+  }
+
+  return sub;
+}
+
+/** read a random token from the system random source */
+static void
+_batch_token(gchar *token, gsize size)
+{
+  int fh;
+  gsize i;
+  guint8 bytes[16];
+
+  g_assert(size > sizeof(bytes) * 2);
+
+  fh = open("/dev/urandom", O_RDONLY);
+  if (fh == -1 || read(fh, bytes, sizeof(bytes)) != sizeof(bytes))
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	  "Failed to read random batch token, using pseudo random token.");
+    for (i = 0; i < sizeof(bytes); i++)
+      bytes[i] = g_random_int() & 0xff;
+  }
+
+  if (fh != -1)
+    close(fh);
+
+  for (i = 0; i < sizeof(bytes); i++)
+    g_snprintf(token + i * 2, 3, "%.2x", bytes[i]);
+}
+
+cio_batch_t *
+cio_batch_new(cio_service_t *service)
+{
+  cio_batch_t *batch;
+
+  batch = g_malloc(sizeof(cio_batch_t));
+  memset(batch, 0, sizeof(cio_batch_t));
+
+  batch->service = service;
+  batch->session = soup_session_new_with_options(SOUP_SESSION_MAX_CONNS,
+						 BATCH_MAX_CONNECTIONS,
+						 SOUP_SESSION_MAX_CONNS_PER_HOST,
+						 BATCH_MAX_CONNECTIONS,
+						 NULL);
+
+  /* random token which lets sub-requests pass authentication */
+  _batch_token(batch->token, sizeof(batch->token));
+
+  return batch;
+}
+
+void
+cio_batch_destroy(cio_batch_t *self)
+{
+  soup_session_abort(self->session);
+  g_object_unref(self->session);
+  g_free(self);
+}
+
+void
+cio_batch_request_started(SoupServer *server, SoupMessage *msg,
+			  SoupClientContext *client, gpointer user_data)
+{
+  const gchar *host;
+  GInetAddress *address;
+
+  host = soup_client_context_get_host(client);
+  if (host == NULL)
+    return;
+
+  /* an ipv4 client of an ipv6 socket */
+  if (g_str_has_prefix(host, "::ffff:"))
+    host += strlen("::ffff:");
+
+  address = g_inet_address_new_from_string(host);
+  if (address == NULL)
+    return;
+
+  if (g_inet_address_get_is_loopback(address))
+    g_object_set_data(G_OBJECT(msg), BATCH_LOOPBACK_KEY, GINT_TO_POINTER(TRUE));
+
+  g_object_unref(address);
+}
+
+gboolean
+cio_batch_authorized(cio_batch_t *self, SoupMessage *msg)
+{
+  const gchar *token;
+
+  if (!g_object_get_data(G_OBJECT(msg), BATCH_LOOPBACK_KEY))
+    return FALSE;
+
+  token = soup_message_headers_get_one(msg->request_headers, BATCH_TOKEN_HEADER);
+  return (token && strcmp(token, self->token) == 0);
+}
+
+void
+cio_batch_request_handler(SoupServer *server, SoupMessage *msg,
+			  const char *path, GHashTable *query,
+			  SoupClientContext *client, gpointer user_data)
+{
+  guint i;
+  guint length;
+  const gchar *value;
+  const gchar *subpath;
+  GError *err;
+  JsonArray *entries;
+  JsonObject *result;
+  JsonParser *parser;
+  SoupMessage *sub;
+  SoupURI *base;
+  cio_service_t *service;
+  _batch_job_t *job;
+  _batch_request_t *request;
+
+  service = (cio_service_t *)user_data;
+  err = NULL;
+
+  if (msg->method != SOUP_METHOD_POST)
+  {
+    soup_message_set_status(msg, SOUP_STATUS_METHOD_NOT_ALLOWED);
+    return;
+  }
+
+  if (g_strcmp0(path, "/batch") != 0)
+  {
+    soup_message_set_status(msg, SOUP_STATUS_NOT_FOUND);
+    return;
+  }
+
+  /* sub-requests carry the batch token, a batch is never nested */
+  if (soup_message_headers_get_one(msg->request_headers, BATCH_TOKEN_HEADER))
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_WARNING, "Nested batch request refused.");
+    soup_message_set_status(msg, SOUP_STATUS_FORBIDDEN);
+    return;
+  }
+
+  /* parse list of sub-requests from body */
+  parser = json_parser_new();
+  if (!json_parser_load_from_data(parser,
+				  msg->request_body->data,
+				  msg->request_body->length, &err))
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	  "Failed to parse batch request: %s", err->message);
+    g_clear_error(&err);
+    g_object_unref(parser);
+    soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+    return;
+  }
+
+  if (!JSON_NODE_HOLDS_ARRAY(json_parser_get_root(parser)))
+  {
+    g_object_unref(parser);
+    soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+    return;
+  }
+
+  entries = json_node_get_array(json_parser_get_root(parser));
+  length = json_array_get_length(entries);
+  if (length == 0 || length > BATCH_MAX_REQUESTS)
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	  "Batch request of %d sub-requests refused.", length);
+    g_object_unref(parser);
+    soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+    return;
+  }
+
+  job = g_new0(_batch_job_t, 1);
+  job->server = server;
+  job->msg = msg;
+  job->results = g_ptr_array_new_with_free_func(_batch_result_free);
+  g_ptr_array_set_size(job->results, length);
+  job->pretty = cio_response_pretty(query);
+
+  value = query ? g_hash_table_lookup(query, "stream") : NULL;
+  job->stream = (value && g_strcmp0(value, "0") != 0);
+
+  if (job->stream)
+  {
+    soup_message_headers_set_encoding(msg->response_headers, SOUP_ENCODING_CHUNKED);
+    soup_message_headers_set_content_type(msg->response_headers,
+					  "application/x-ndjson; charset=utf-8", NULL);
+    soup_message_body_set_accumulate(msg->response_body, FALSE);
+    soup_message_set_status(msg, SOUP_STATUS_OK);
+  }
+
+  g_signal_connect(msg, "finished", G_CALLBACK(_batch_job_finished), job);
+  soup_server_pause_message(server, msg);
+
+  /* dispatch all valid sub-requests concurrently */
+  base = _batch_base_uri(server);
+  job->pending = 1;
+  for (i = 0; i < length; i++)
+  {
+    sub = _batch_request_new(service->batch, base,
+			     json_array_get_element(entries, i), &subpath);
+    if (sub == NULL)
+    {
+      result = json_object_new();
+      if (subpath)
+	json_object_set_string_member(result, "path", subpath);
+      json_object_set_int_member(result, "status", SOUP_STATUS_BAD_REQUEST);
+      _batch_job_add(job, i, result);
+      continue;
+    }
+
+    request = g_new0(_batch_request_t, 1);
+    request->job = job;
+    request->index = i;
+    request->path = g_strdup(subpath);
+
+    job->pending++;
+    soup_session_queue_message(service->batch->session, sub,
+			       _batch_request_done, request);
+  }
+  g_object_unref(parser);
+
+  if (base)
+    soup_uri_free(base);
+
+  /* drop the reference held while dispatching */
+  if (--job->pending == 0)
+    _batch_job_complete(job);
+}
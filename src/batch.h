@@ -0,0 +1,48 @@
+/*
+ * This file is part of cast.io
+ *
+ * Copyright 2014 Henrik Andersson <henrik.4e@gmail.com>
+ *
+ * cast.io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cast.io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cast.io.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _batch_h
+#define _batch_h
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+struct cio_batch_t;
+struct cio_service_t;
+
+struct cio_batch_t *cio_batch_new(struct cio_service_t *service);
+
+void cio_batch_destroy(struct cio_batch_t *self);
+
+/** mark a request received on the loopback interface, connect to
+    the "request-started" signal of server */
+void cio_batch_request_started(SoupServer *server, SoupMessage *msg,
+			       SoupClientContext *client, gpointer user_data);
+
+/** check if msg is a sub-request dispatched by a batch from the
+    loopback interface, these are already authenticated by the batch
+    request */
+gboolean cio_batch_authorized(struct cio_batch_t *self, SoupMessage *msg);
+
+void cio_batch_request_handler(SoupServer *server, SoupMessage *msg,
+			       const char *path, GHashTable *query,
+			       SoupClientContext *client, gpointer user_data);
+
+#endif /* _batch_h */
@@ -35,7 +35,8 @@
 
 typedef struct cio_blobcache_t
 {
-  int dummy;
+  /* serializes access of cache files between threads */
+  GMutex lock;
 } cio_blobcache_t;
 
 typedef struct _cache_item_t
@@ -51,18 +52,20 @@ cio_blobcache_new()
   cio_blobcache_t *cache;
   cache = g_malloc(sizeof(cio_blobcache_t));
   memset(cache, 0, sizeof(cio_blobcache_t));
+  g_mutex_init(&cache->lock);
   return cache;
 }
 
 void
 cio_blobcache_destroy(cio_blobcache_t *self)
 {
+  g_mutex_clear(&self->lock);
   g_free(self);
 }
 
-int
-cio_blobcache_store(cio_blobcache_t *self, time_t expire, uint32_t hash,
-		    const void *data, size_t size)
+static int
+_blobcache_store(cio_blobcache_t *self, time_t expire, uint32_t hash,
+		 const void *data, size_t size)
 {
   int fh;
   int res;
@@ -128,8 +131,21 @@ cio_blobcache_store(cio_blobcache_t *self, time_t expire, uint32_t hash,
 }
 
 int
-cio_blobcache_get(cio_blobcache_t *self, uint32_t hash,
-		  void **data, size_t *size)
+cio_blobcache_store(cio_blobcache_t *self, time_t expire, uint32_t hash,
+		    const void *data, size_t size)
+{
+  int res;
+
+  g_mutex_lock(&self->lock);
+  res = _blobcache_store(self, expire, hash, data, size);
+  g_mutex_unlock(&self->lock);
+
+  return res;
+}
+
+static int
+_blobcache_get(cio_blobcache_t *self, uint32_t hash,
+	       void **data, size_t *size)
 {
   int fh, res;
   struct stat sb;
@@ -178,4 +194,15 @@ cio_blobcache_get(cio_blobcache_t *self, uint32_t hash,
   return 0;
 }
 
+int
+cio_blobcache_get(cio_blobcache_t *self, uint32_t hash,
+		  void **data, size_t *size)
+{
+  int res;
+
+  g_mutex_lock(&self->lock);
+  res = _blobcache_get(self, hash, data, size);
+  g_mutex_unlock(&self->lock);
 
+  return res;
+}
@@ -0,0 +1,270 @@
+/*
+ * This file is part of cast.io
+ *
+ * Copyright 2014 Henrik Andersson <henrik.4e@gmail.com>
+ *
+ * cast.io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cast.io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cast.io.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+#include <gio/gio.h>
+
+#include "bundle.h"
+
+/* signatures of zip records */
+#define BUNDLE_EOCD_SIGNATURE 0x06054b50
+#define BUNDLE_CENTRAL_SIGNATURE 0x02014b50
+#define BUNDLE_LOCAL_SIGNATURE 0x04034b50
+
+/* fixed sizes of zip records */
+#define BUNDLE_EOCD_SIZE 22
+#define BUNDLE_CENTRAL_SIZE 46
+#define BUNDLE_LOCAL_SIZE 30
+
+/* maximum length of archive comment after end of central directory */
+#define BUNDLE_MAX_COMMENT 0xffff
+
+/* largest entry read and the largest ratio of its size to its
+   compressed size, deflate does not compress better than about 1032:1 */
+#define BUNDLE_MAX_SIZE (64L * 1024L * 1024L)
+#define BUNDLE_MAX_RATIO 1032
+
+/* compression methods */
+#define BUNDLE_STORED 0
+#define BUNDLE_DEFLATED 8
+
+#define BUNDLE_ERROR g_quark_from_static_string("bundle")
+
+typedef struct _bundle_entry_t
+{
+  guint16 method;
+  guint32 compressed;
+  guint32 size;
+  guint32 offset;
+} _bundle_entry_t;
+
+typedef struct cio_bundle_t
+{
+  GMappedFile *file;
+  const guchar *data;
+  gsize length;
+
+  /* entries by name */
+  GHashTable *entries;
+} cio_bundle_t;
+
+static guint16
+_bundle_u16(const guchar *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static guint32
+_bundle_u32(const guchar *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((guint32)p[3] << 24);
+}
+
+/** find end of central directory record, NULL if not found */
+static const guchar *
+_bundle_eocd(cio_bundle_t *self)
+{
+  gsize i, last, first;
+
+  if (self->length < BUNDLE_EOCD_SIZE)
+    return NULL;
+
+  last = self->length - BUNDLE_EOCD_SIZE;
+  first = last > BUNDLE_MAX_COMMENT ? last - BUNDLE_MAX_COMMENT : 0;
+
+  for (i = last + 1; i > first; i--)
+  {
+    if (_bundle_u32(self->data + i - 1) == BUNDLE_EOCD_SIGNATURE)
+      return self->data + i - 1;
+  }
+
+  return NULL;
+}
+
+/** index entries of central directory */
+static gboolean
+_bundle_index(cio_bundle_t *self)
+{
+  guint i, count;
+  guint16 namelen, extralen, commentlen;
+  gsize offset, end;
+  const guchar *eocd, *p;
+  _bundle_entry_t *entry;
+
+  eocd = _bundle_eocd(self);
+  if (eocd == NULL)
+    return FALSE;
+
+  count = _bundle_u16(eocd + 10);
+  offset = _bundle_u32(eocd + 16);
+  end = offset + (gsize)_bundle_u32(eocd + 12);
+  if (end > self->length)
+    return FALSE;
+
+  for (i = 0; i < count; i++)
+  {
+    p = self->data + offset;
+    if (end - offset < BUNDLE_CENTRAL_SIZE || _bundle_u32(p) != BUNDLE_CENTRAL_SIGNATURE)
+      return FALSE;
+
+    namelen = _bundle_u16(p + 28);
+    extralen = _bundle_u16(p + 30);
+    commentlen = _bundle_u16(p + 32);
+    if (end - offset - BUNDLE_CENTRAL_SIZE < namelen)
+      return FALSE;
+
+    entry = g_new0(_bundle_entry_t, 1);
+    entry->method = _bundle_u16(p + 10);
+    entry->compressed = _bundle_u32(p + 20);
+    entry->size = _bundle_u32(p + 24);
+    entry->offset = _bundle_u32(p + 42);
+
+    g_hash_table_replace(self->entries,
+			 g_strndup((const gchar *)p + BUNDLE_CENTRAL_SIZE, namelen),
+			 entry);
+
+    offset += BUNDLE_CENTRAL_SIZE + namelen + extralen + commentlen;
+    if (offset > end)
+      offset = end;
+  }
+
+  return TRUE;
+}
+
+cio_bundle_t *
+cio_bundle_open(const gchar *filename, GError **err)
+{
+  GMappedFile *file;
+  cio_bundle_t *bundle;
+
+  file = g_mapped_file_new(filename, FALSE, err);
+  if (file == NULL)
+    return NULL;
+
+  bundle = g_malloc(sizeof(cio_bundle_t));
+  memset(bundle, 0, sizeof(cio_bundle_t));
+
+  bundle->file = file;
+  bundle->data = (const guchar *)g_mapped_file_get_contents(file);
+  bundle->length = g_mapped_file_get_length(file);
+  bundle->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+  if (!_bundle_index(bundle))
+  {
+    g_set_error(err, BUNDLE_ERROR, 0,
+		"'%s' is not a zip archive or is corrupt", filename);
+    cio_bundle_close(bundle);
+    return NULL;
+  }
+
+  return bundle;
+}
+
+void
+cio_bundle_close(cio_bundle_t *self)
+{
+  g_hash_table_destroy(self->entries);
+  g_mapped_file_unref(self->file);
+  g_free(self);
+}
+
+gboolean
+cio_bundle_contains(cio_bundle_t *self, const gchar *name)
+{
+  return g_hash_table_lookup(self->entries, name) != NULL;
+}
+
+gchar *
+cio_bundle_read(cio_bundle_t *self, const gchar *name, gsize *length, GError **err)
+{
+  gsize read, written, start, size;
+  gchar *content;
+  const guchar *p;
+  GConverter *inflater;
+  GConverterResult res;
+  _bundle_entry_t *entry;
+
+  entry = g_hash_table_lookup(self->entries, name);
+  if (entry == NULL)
+  {
+    g_set_error(err, BUNDLE_ERROR, 0, "No entry '%s' in bundle", name);
+    return NULL;
+  }
+
+  /* locate data after the local header of entry */
+  start = entry->offset;
+  if (start > self->length || self->length - start < BUNDLE_LOCAL_SIZE
+      || _bundle_u32(self->data + start) != BUNDLE_LOCAL_SIGNATURE)
+    goto corrupt;
+
+  p = self->data + start;
+  start += BUNDLE_LOCAL_SIZE + _bundle_u16(p + 26) + _bundle_u16(p + 28);
+  if (start > self->length || self->length - start < entry->compressed)
+    goto corrupt;
+
+  /* refuse an entry that inflates beyond reason */
+  size = entry->size;
+  if (size > BUNDLE_MAX_SIZE || size > (gsize)entry->compressed * BUNDLE_MAX_RATIO)
+  {
+    g_set_error(err, BUNDLE_ERROR, 0, "Entry '%s' of bundle is too large", name);
+    return NULL;
+  }
+
+  p = self->data + start;
+  content = g_malloc(size + 1);
+  content[size] = '\0';
+
+  if (entry->method == BUNDLE_STORED && entry->compressed == entry->size)
+    memcpy(content, p, size);
+
+  else if (entry->method == BUNDLE_DEFLATED)
+  {
+    inflater = G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW));
+    res = g_converter_convert(inflater, p, entry->compressed,
+			      content, size + 1,
+			      G_CONVERTER_INPUT_AT_END, &read, &written, err);
+    g_object_unref(inflater);
+
+    if (res != G_CONVERTER_FINISHED || written != size)
+    {
+      g_free(content);
+      if (res != G_CONVERTER_ERROR)
+	goto corrupt;
+      return NULL;
+    }
+    content[size] = '\0';
+  }
+
+  else
+  {
+    g_free(content);
+    g_set_error(err, BUNDLE_ERROR, 0,
+		"Entry '%s' has unsupported compression method %d", name, entry->method);
+    return NULL;
+  }
+
+  if (length)
+    *length = size;
+  return content;
+
+corrupt:
+  g_set_error(err, BUNDLE_ERROR, 0, "Entry '%s' of bundle is corrupt", name);
+  return NULL;
+}
@@ -0,0 +1,41 @@
+/*
+ * This file is part of cast.io
+ *
+ * Copyright 2014 Henrik Andersson <henrik.4e@gmail.com>
+ *
+ * cast.io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cast.io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cast.io.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _bundle_h
+#define _bundle_h
+
+#include <glib.h>
+
+struct cio_bundle_t;
+
+/** open a zip archive mapped in memory and index its entries by name
+    from the central directory */
+struct cio_bundle_t *cio_bundle_open(const gchar *filename, GError **err);
+void cio_bundle_close(struct cio_bundle_t *self);
+
+/** check if bundle has an entry with name */
+gboolean cio_bundle_contains(struct cio_bundle_t *self, const gchar *name);
+
+/** read entry of bundle, the returned content is NUL terminated and
+    freed by caller */
+gchar *cio_bundle_read(struct cio_bundle_t *self, const gchar *name,
+		       gsize *length, GError **err);
+
+#endif /* _bundle_h */
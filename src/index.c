@@ -0,0 +1,754 @@
+/*
+ * This file is part of cast.io
+ *
+ * Copyright 2014 Henrik Andersson <henrik.4e@gmail.com>
+ *
+ * cast.io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cast.io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cast.io.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+
+#include "index.h"
+#include "provider.h"
+
+#define DOMAIN "index"
+
+/* interval in seconds between flushes of the index log */
+#define INDEX_FLUSH_INTERVAL 5
+
+/* maximum number of items kept in the index */
+#define INDEX_MAX_DOCUMENTS 100000
+
+/* minimum number of superseded items before the index is compacted */
+#define INDEX_COMPACT_THRESHOLD 1024
+
+/* an indexed item serialized as json */
+typedef struct _index_doc_t
+{
+  guint id;
+  gchar *key;
+  gchar *provider;
+  gchar *type;
+  gchar *data;
+} _index_doc_t;
+
+/* a compacted log written by a thread while the index is used, the
+   lines logged meanwhile are appended when it replaces the log */
+typedef struct _index_compaction_t
+{
+  struct cio_index_t *index;
+  GThread *thread;
+  gchar *tmp;
+  GPtrArray *lines;
+  GPtrArray *pending;
+  gboolean written;
+} _index_compaction_t;
+
+typedef struct cio_index_t
+{
+  gchar *filename;
+  FILE *log;
+  guint flusher;
+  _index_compaction_t *compaction;
+
+  /* documents by id, superseded documents are NULL */
+  GPtrArray *docs;
+  guint dead;
+
+  /* live documents by provider and uri */
+  GHashTable *keys;
+
+  /* ascending document ids by term */
+  GHashTable *postings;
+} cio_index_t;
+
+static void
+_index_doc_free(_index_doc_t *doc)
+{
+  if (doc == NULL)
+    return;
+
+  g_free(doc->data);
+  g_free(doc->type);
+  g_free(doc->provider);
+  g_free(doc->key);
+  g_free(doc);
+}
+
+static const gchar *
+_index_string(JsonObject *object, const gchar *member)
+{
+  JsonNode *node;
+
+  if (object == NULL || !json_object_has_member(object, member))
+    return NULL;
+
+  node = json_object_get_member(object, member);
+  if (!JSON_NODE_HOLDS_VALUE(node) || json_node_get_value_type(node) != G_TYPE_STRING)
+    return NULL;
+
+  return json_node_get_string(node);
+}
+
+/** split text into lower case alphanumeric terms added to set terms */
+static void
+_index_tokenize(const gchar *text, GHashTable *terms)
+{
+  gchar *lower;
+  const gchar *p;
+  gunichar c;
+  GString *term;
+
+  if (text == NULL)
+    return;
+
+  lower = g_utf8_strdown(text, -1);
+  term = g_string_new(NULL);
+
+  for (p = lower; ; p = g_utf8_next_char(p))
+  {
+    c = g_utf8_get_char(p);
+    if (c != 0 && g_unichar_isalnum(c))
+    {
+      g_string_append_unichar(term, c);
+      continue;
+    }
+
+    if (term->len)
+      g_hash_table_add(terms, g_strdup(term->str));
+    g_string_truncate(term, 0);
+
+    if (c == 0)
+      break;
+  }
+
+  g_string_free(term, TRUE);
+  g_free(lower);
+}
+
+/** add document to the postings of the terms of the title, artist
+    and description of item */
+static void
+_index_post(cio_index_t *self, _index_doc_t *doc, cio_provider_item_t *item)
+{
+  GArray *ids;
+  gpointer term;
+  GHashTable *terms;
+  GHashTableIter iter;
+
+  terms = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  _index_tokenize(item->title, terms);
+  _index_tokenize(item->artist, terms);
+  _index_tokenize(item->description, terms);
+
+  g_hash_table_iter_init(&iter, terms);
+  while (g_hash_table_iter_next(&iter, &term, NULL))
+  {
+    ids = g_hash_table_lookup(self->postings, term);
+    if (ids == NULL)
+    {
+      ids = g_array_new(FALSE, FALSE, sizeof(guint));
+      g_hash_table_insert(self->postings, g_strdup(term), ids);
+    }
+    g_array_append_val(ids, doc->id);
+  }
+
+  g_hash_table_destroy(terms);
+}
+
+/** get the start of the log line of an item of provider */
+static gchar *
+_index_line_prefix(const gchar *provider)
+{
+  gchar *name;
+  gchar *prefix;
+  JsonNode *node;
+  JsonGenerator *gen;
+
+  node = json_node_alloc();
+  json_node_init_string(node, provider);
+
+  gen = json_generator_new();
+  json_generator_set_root(gen, node);
+  name = json_generator_to_data(gen, NULL);
+  g_object_unref(gen);
+  json_node_free(node);
+
+  prefix = g_strdup_printf("{\"provider\":%s,\"item\":", name);
+  g_free(name);
+
+  return prefix;
+}
+
+/** get the log line of serialized item of provider */
+static gchar *
+_index_serialize(const gchar *provider, const gchar *data)
+{
+  gchar *line;
+  gchar *prefix;
+
+  prefix = _index_line_prefix(provider);
+  line = g_strdup_printf("%s%s}", prefix, data);
+  g_free(prefix);
+
+  return line;
+}
+
+static FILE *
+_index_log(cio_index_t *self)
+{
+  if (self->log)
+    return self->log;
+
+  self->log = fopen(self->filename, "a");
+  if (self->log == NULL)
+    g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	  "Failed to open index log '%s': %s", self->filename, strerror(errno));
+
+  return self->log;
+}
+
+/** write the compacted log, done on the main loop */
+static gboolean _index_compaction_done(gpointer user_data);
+
+static gpointer
+_index_compaction_write(gpointer user_data)
+{
+  guint i;
+  FILE *fp;
+  _index_compaction_t *compaction;
+
+  compaction = (_index_compaction_t *)user_data;
+
+  fp = fopen(compaction->tmp, "w");
+  if (fp == NULL)
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	  "Failed to create index log '%s': %s", compaction->tmp, strerror(errno));
+    goto done;
+  }
+
+  for (i = 0; i < compaction->lines->len; i++)
+    fprintf(fp, "%s\n", (gchar *)g_ptr_array_index(compaction->lines, i));
+
+  compaction->written = !ferror(fp);
+  if (fclose(fp) != 0)
+    compaction->written = FALSE;
+
+  if (!compaction->written)
+    g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	  "Failed to write index log '%s'.", compaction->tmp);
+
+done:
+  g_idle_add(_index_compaction_done, compaction);
+  return NULL;
+}
+
+/** replace the log with the compacted one and append the lines
+    logged while it was written, the old log is kept on failure */
+static void
+_index_compaction_finish(_index_compaction_t *compaction)
+{
+  guint i;
+  FILE *fp;
+  cio_index_t *self;
+
+  self = compaction->index;
+
+  if (compaction->written)
+  {
+    if (self->log)
+      fclose(self->log);
+    self->log = NULL;
+
+    if (g_rename(compaction->tmp, self->filename) != 0)
+      g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	    "Failed to replace index log '%s': %s", self->filename, strerror(errno));
+    else if ((fp = _index_log(self)) != NULL)
+    {
+      for (i = 0; i < compaction->pending->len; i++)
+	fprintf(fp, "%s\n", (gchar *)g_ptr_array_index(compaction->pending, i));
+    }
+  }
+  else
+    g_unlink(compaction->tmp);
+
+  self->compaction = NULL;
+
+  g_ptr_array_free(compaction->pending, TRUE);
+  g_ptr_array_free(compaction->lines, TRUE);
+  g_free(compaction->tmp);
+  g_free(compaction);
+}
+
+static gboolean
+_index_compaction_done(gpointer user_data)
+{
+  _index_compaction_t *compaction;
+  compaction = (_index_compaction_t *)user_data;
+
+  g_thread_join(compaction->thread);
+  _index_compaction_finish(compaction);
+
+  return FALSE;
+}
+
+/** renumber documents without superseded items and rewrite the log
+    on a thread */
+static void
+_index_compact(cio_index_t *self)
+{
+  guint i, j, n;
+  guint *ids;
+  GArray *postings;
+  GPtrArray *docs;
+  GHashTableIter iter;
+  gpointer value;
+  _index_doc_t *doc;
+  _index_compaction_t *compaction;
+
+  g_log(DOMAIN, G_LOG_LEVEL_INFO,
+	"Compacting index, dropping %d superseded items.", self->dead);
+
+  compaction = g_new0(_index_compaction_t, 1);
+  compaction->index = self;
+  compaction->tmp = g_strdup_printf("%s.tmp", self->filename);
+  compaction->lines = g_ptr_array_new_with_free_func(g_free);
+  compaction->pending = g_ptr_array_new_with_free_func(g_free);
+
+  docs = g_ptr_array_new_with_free_func((GDestroyNotify)_index_doc_free);
+  ids = g_new(guint, self->docs->len);
+
+  for (i = 0; i < self->docs->len; i++)
+  {
+    ids[i] = G_MAXUINT;
+    doc = g_ptr_array_index(self->docs, i);
+    if (doc == NULL)
+      continue;
+
+    /* move document to new array */
+    self->docs->pdata[i] = NULL;
+    ids[i] = doc->id = docs->len;
+    g_ptr_array_add(docs, doc);
+
+    g_ptr_array_add(compaction->lines, _index_serialize(doc->provider, doc->data));
+  }
+
+  /* renumber postings, ids stay ascending */
+  g_hash_table_iter_init(&iter, self->postings);
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+  {
+    postings = (GArray *)value;
+    for (j = 0, n = 0; j < postings->len; j++)
+    {
+      if (ids[g_array_index(postings, guint, j)] != G_MAXUINT)
+	g_array_index(postings, guint, n++) = ids[g_array_index(postings, guint, j)];
+    }
+
+    if (n == 0)
+      g_hash_table_iter_remove(&iter);
+    else
+      g_array_set_size(postings, n);
+  }
+
+  g_free(ids);
+  g_ptr_array_free(self->docs, TRUE);
+  self->docs = docs;
+  self->dead = 0;
+
+  self->compaction = compaction;
+  compaction->thread = g_thread_new("index", _index_compaction_write, compaction);
+}
+
+/** add or replace item of provider serialized as the length bytes of
+    data, returns the log line of the item if the index was changed */
+static gchar *
+_index_update(cio_index_t *self, const gchar *provider, const gchar *data,
+	      cio_provider_item_t *item)
+{
+  gchar *key;
+  _index_doc_t *doc, *old;
+
+  if (item == NULL || item->uri == NULL)
+    return NULL;
+
+  key = g_strdup_printf("%s\n%s", provider, item->uri);
+
+  /* skip unchanged items */
+  old = g_hash_table_lookup(self->keys, key);
+  if (old && strlen(old->data) == item->length
+      && memcmp(old->data, data, item->length) == 0)
+    goto unchanged;
+
+  if (old == NULL && g_hash_table_size(self->keys) >= INDEX_MAX_DOCUMENTS)
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_DEBUG,
+	  "Index is full, item '%s' of '%s' not indexed.", item->uri, provider);
+    goto unchanged;
+  }
+
+  doc = g_new0(_index_doc_t, 1);
+  doc->id = self->docs->len;
+  doc->key = key;
+  doc->provider = g_strdup(provider);
+  doc->type = g_strdup(item->type);
+  doc->data = g_strndup(data, item->length);
+  g_ptr_array_add(self->docs, doc);
+  g_hash_table_replace(self->keys, doc->key, doc);
+  _index_post(self, doc, item);
+
+  /* supersede previous version of item */
+  if (old)
+  {
+    self->docs->pdata[old->id] = NULL;
+    self->dead++;
+    _index_doc_free(old);
+  }
+
+  return _index_serialize(provider, doc->data);
+
+unchanged:
+  g_free(key);
+  return NULL;
+}
+
+/** add item of the log line, the item is taken as written to the log */
+static void
+_index_load_line(cio_index_t *self, const gchar *line, gsize length,
+		 const gchar *provider, JsonNode *item)
+{
+  gsize size;
+  gchar *data;
+  gchar *prefix;
+  JsonGenerator *gen;
+  cio_provider_item_t *entry;
+
+  entry = cio_provider_item_new(item);
+  if (entry == NULL)
+    return;
+
+  prefix = _index_line_prefix(provider);
+  size = strlen(prefix);
+  if (g_str_has_prefix(line, prefix) && length > size && line[length - 1] == '}')
+  {
+    data = g_strndup(line + size, length - size - 1);
+    entry->length = length - size - 1;
+  }
+  else
+  {
+    gen = json_generator_new();
+    json_generator_set_root(gen, item);
+    data = json_generator_to_data(gen, &entry->length);
+    g_object_unref(gen);
+  }
+  g_free(prefix);
+
+  g_free(_index_update(self, provider, data, entry));
+  cio_provider_item_free(entry);
+  g_free(data);
+}
+
+/** replay the index log */
+static void
+_index_load(cio_index_t *self)
+{
+  gsize length;
+  gchar *content;
+  gchar *line, *end;
+  JsonNode *root;
+  JsonObject *object;
+  JsonParser *parser;
+  const gchar *provider;
+  GError *err;
+
+  err = NULL;
+  if (!g_file_get_contents(self->filename, &content, &length, &err))
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_DEBUG,
+	  "No index loaded: %s", err->message);
+    g_clear_error(&err);
+    return;
+  }
+
+  parser = json_parser_new();
+  for (line = content; line < content + length; line = end + 1)
+  {
+    end = strchr(line, '\n');
+    if (end == NULL)
+      end = content + length;
+    *end = '\0';
+
+    if (*line == '\0' || !json_parser_load_from_data(parser, line, -1, NULL))
+      continue;
+
+    root = json_parser_get_root(parser);
+    if (root == NULL || !JSON_NODE_HOLDS_OBJECT(root))
+      continue;
+
+    object = json_node_get_object(root);
+    provider = _index_string(object, "provider");
+    if (provider == NULL || !json_object_has_member(object, "item"))
+      continue;
+
+    _index_load_line(self, line, end - line, provider,
+		     json_object_get_member(object, "item"));
+  }
+
+  g_object_unref(parser);
+  g_free(content);
+
+  g_log(DOMAIN, G_LOG_LEVEL_INFO,
+	"Loaded %d items into index from '%s'.",
+	g_hash_table_size(self->keys), self->filename);
+}
+
+static gboolean
+_index_flush(gpointer user_data)
+{
+  cio_index_t *self;
+  self = (cio_index_t *)user_data;
+
+  if (self->log)
+    fflush(self->log);
+
+  return TRUE;
+}
+
+static gint
+_index_compare_postings(gconstpointer a, gconstpointer b)
+{
+  guint la, lb;
+
+  la = (*(GArray **)a)->len;
+  lb = (*(GArray **)b)->len;
+  return (la > lb) - (la < lb);
+}
+
+/** binary search for document id in ascending ids */
+static gboolean
+_index_contains(GArray *ids, guint id)
+{
+  guint lo, hi, mid, value;
+
+  lo = 0;
+  hi = ids->len;
+  while (lo < hi)
+  {
+    mid = lo + (hi - lo) / 2;
+    value = g_array_index(ids, guint, mid);
+    if (value == id)
+      return TRUE;
+    else if (value < id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return FALSE;
+}
+
+static gboolean
+_index_has_type(_index_doc_t *doc, gchar **types)
+{
+  gchar **it;
+
+  if (types == NULL)
+    return TRUE;
+
+  if (doc->type == NULL)
+    return FALSE;
+
+  for (it = types; *it; it++)
+  {
+    if (strcmp(*it, doc->type) == 0)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+cio_index_t *
+cio_index_new(const gchar *filename)
+{
+  gchar *path;
+  cio_index_t *index;
+
+  index = g_malloc(sizeof(cio_index_t));
+  memset(index, 0, sizeof(cio_index_t));
+
+  index->filename = g_strdup(filename);
+  index->docs = g_ptr_array_new_with_free_func((GDestroyNotify)_index_doc_free);
+  index->keys = g_hash_table_new(g_str_hash, g_str_equal);
+  index->postings = g_hash_table_new_full(g_str_hash, g_str_equal,
+					  g_free, (GDestroyNotify)g_array_unref);
+
+  path = g_path_get_dirname(filename);
+  g_mkdir_with_parents(path, 0700);
+  g_free(path);
+
+  _index_load(index);
+  if (index->dead > INDEX_COMPACT_THRESHOLD)
+    _index_compact(index);
+
+  index->flusher = g_timeout_add_seconds(INDEX_FLUSH_INTERVAL, _index_flush, index);
+
+  return index;
+}
+
+void
+cio_index_destroy(cio_index_t *self)
+{
+  g_source_remove(self->flusher);
+
+  /* wait for a compacted log to be written */
+  if (self->compaction)
+  {
+    g_thread_join(self->compaction->thread);
+    g_idle_remove_by_data(self->compaction);
+    _index_compaction_finish(self->compaction);
+  }
+
+  if (self->log)
+    fclose(self->log);
+
+  g_hash_table_destroy(self->postings);
+  g_hash_table_destroy(self->keys);
+  g_ptr_array_free(self->docs, TRUE);
+  g_free(self->filename);
+  g_free(self);
+}
+
+void
+cio_index_add(cio_index_t *self, const gchar *provider, JsonNode *item)
+{
+  gchar *data;
+  JsonGenerator *gen;
+  cio_provider_item_t *entry;
+
+  entry = cio_provider_item_new(item);
+  if (entry == NULL)
+    return;
+
+  gen = json_generator_new();
+  json_generator_set_root(gen, item);
+  data = json_generator_to_data(gen, &entry->length);
+  g_object_unref(gen);
+
+  cio_index_add_data(self, provider, data, entry);
+
+  cio_provider_item_free(entry);
+  g_free(data);
+}
+
+void
+cio_index_add_data(cio_index_t *self, const gchar *provider, const gchar *data,
+		   cio_provider_item_t *item)
+{
+  FILE *fp;
+  gchar *line;
+
+  line = _index_update(self, provider, data, item);
+  if (line == NULL)
+    return;
+
+  fp = _index_log(self);
+  if (fp)
+    fprintf(fp, "%s\n", line);
+
+  /* keep line for the log being compacted */
+  if (self->compaction)
+    g_ptr_array_add(self->compaction->pending, line);
+  else
+    g_free(line);
+
+  if (self->dead > INDEX_COMPACT_THRESHOLD && self->compaction == NULL
+      && self->dead > g_hash_table_size(self->keys))
+    _index_compact(self);
+}
+
+JsonArray *
+cio_index_search(cio_index_t *self, gchar **keywords, gchar **types, guint limit)
+{
+  guint i, j, id;
+  gchar **it;
+  gpointer term;
+  GArray *ids;
+  GPtrArray *lists;
+  GHashTable *terms;
+  GHashTableIter iter;
+  JsonArray *result;
+  JsonObject *object;
+  JsonParser *parser;
+  _index_doc_t *doc;
+
+  result = json_array_new();
+  lists = g_ptr_array_new();
+  parser = json_parser_new();
+
+  terms = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  for (it = keywords; *it; it++)
+    _index_tokenize(*it, terms);
+
+  if (g_hash_table_size(terms) == 0)
+    goto finished;
+
+  /* all terms must be indexed for any match */
+  g_hash_table_iter_init(&iter, terms);
+  while (g_hash_table_iter_next(&iter, &term, NULL))
+  {
+    ids = g_hash_table_lookup(self->postings, term);
+    if (ids == NULL)
+      goto finished;
+    g_ptr_array_add(lists, ids);
+  }
+
+  /* walk the shortest postings from most recent item */
+  g_ptr_array_sort(lists, _index_compare_postings);
+  ids = g_ptr_array_index(lists, 0);
+
+  for (i = ids->len; i > 0 && json_array_get_length(result) < limit; i--)
+  {
+    id = g_array_index(ids, guint, i - 1);
+    doc = g_ptr_array_index(self->docs, id);
+    if (doc == NULL || !_index_has_type(doc, types))
+      continue;
+
+    for (j = 1; j < lists->len; j++)
+    {
+      if (!_index_contains(g_ptr_array_index(lists, j), id))
+	break;
+    }
+
+    if (j < lists->len
+	|| !json_parser_load_from_data(parser, doc->data, -1, NULL))
+      continue;
+
+    object = json_object_new();
+    json_object_set_string_member(object, "provider", doc->provider);
+    json_object_set_member(object, "item", json_node_copy(json_parser_get_root(parser)));
+    json_array_add_object_element(result, object);
+  }
+
+finished:
+  g_object_unref(parser);
+  g_hash_table_destroy(terms);
+  g_ptr_array_free(lists, TRUE);
+  return result;
+}
@@ -0,0 +1,49 @@
+/*
+ * This file is part of cast.io
+ *
+ * Copyright 2014 Henrik Andersson <henrik.4e@gmail.com>
+ *
+ * cast.io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cast.io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cast.io.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _index_h
+#define _index_h
+
+#include <glib.h>
+#include <json-glib/json-glib.h>
+
+struct cio_index_t;
+struct cio_provider_item_t;
+
+/** create an index persisted in the append log filename, the log is
+    replayed if it exists */
+struct cio_index_t *cio_index_new(const gchar *filename);
+void cio_index_destroy(struct cio_index_t *self);
+
+/** add or update an item seen from provider in the index */
+void cio_index_add(struct cio_index_t *self, const gchar *provider, JsonNode *item);
+
+/** add or update an item of a listing of provider serialized as the
+    length bytes of data with the members of item */
+void cio_index_add_data(struct cio_index_t *self, const gchar *provider,
+			const gchar *data, struct cio_provider_item_t *item);
+
+/** search the index for items matching all keywords and any of types,
+    returns an array of {provider, item} objects with the most recently
+    indexed item first */
+JsonArray *cio_index_search(struct cio_index_t *self, gchar **keywords,
+			    gchar **types, guint limit);
+
+#endif /* _index_h */
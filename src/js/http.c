@@ -30,6 +30,24 @@
 
 #define DOMAIN "provider"
 
+/* minimum milliseconds before a request is hedged */
+#define JS_HTTP_MIN_HEDGE_DELAY 50
+
+/* milliseconds between checks if the call performing a request has
+   exceeded its time budget */
+#define JS_HTTP_EXPIRED_INTERVAL 250
+
+/* state of a hedged request, the first finished message wins */
+typedef struct _js_http_hedge_t
+{
+  GMainLoop *loop;
+  js_provider_t *js;
+  SoupSession *session;
+  SoupMessage *hedge;
+  SoupMessage *winner;
+  gint pending;
+} _js_http_hedge_t;
+
 static gchar *
 _unescape_buffer(gchar *buffer)
 {
@@ -95,6 +113,144 @@ _js_http_unescape_html(js_State *state)
   js_pushstring(state, _unescape_buffer(buffer));
 }
 
+static void
+_js_http_hedge_finished(SoupSession *session, SoupMessage *msg, gpointer user_data)
+{
+  _js_http_hedge_t *hedge;
+  hedge = (_js_http_hedge_t *)user_data;
+
+  hedge->pending--;
+  if (hedge->winner == NULL && msg->status_code != SOUP_STATUS_CANCELLED)
+    hedge->winner = g_object_ref(msg);
+
+  if (hedge->winner || hedge->pending == 0)
+    g_main_loop_quit(hedge->loop);
+}
+
+static gboolean
+_js_http_hedge_fire(gpointer user_data)
+{
+  gchar *uri;
+  _js_http_hedge_t *hedge;
+  hedge = (_js_http_hedge_t *)user_data;
+
+  if (hedge->winner == NULL)
+  {
+    uri = soup_uri_to_string(soup_message_get_uri(hedge->hedge), FALSE);
+    g_log(DOMAIN, G_LOG_LEVEL_DEBUG, "Hedging slow request '%s'", uri);
+    g_free(uri);
+
+    hedge->pending++;
+    soup_session_queue_message(hedge->session, g_object_ref(hedge->hedge),
+			       _js_http_hedge_finished, hedge);
+  }
+
+  return FALSE;
+}
+
+/** cancel the requests when the call has exceeded its time budget */
+static gboolean
+_js_http_hedge_expired(gpointer user_data)
+{
+  _js_http_hedge_t *hedge;
+  hedge = (_js_http_hedge_t *)user_data;
+
+  if (!g_atomic_int_get(&hedge->js->expired))
+    return TRUE;
+
+  soup_session_abort(hedge->session);
+  return FALSE;
+}
+
+static void
+_js_http_copy_header(const char *name, const char *value, gpointer user_data)
+{
+  soup_message_headers_append((SoupMessageHeaders *)user_data, name, value);
+}
+
+/** send an idempotent request, a duplicate request is sent if no
+    response is received within the 95th percentile of the latency of
+    the provider's requests and the first response wins */
+static SoupMessage *
+_js_http_send_hedged(js_provider_t *js, SoupSession *session, SoupMessage *msg)
+{
+  gint64 delay;
+  gint64 started;
+  guint status;
+  gchar *uri;
+  GSource *timer;
+  GSource *expired;
+  GMainContext *context;
+  _js_http_hedge_t hedge;
+
+  memset(&hedge, 0, sizeof(hedge));
+
+  context = g_main_context_new();
+  g_main_context_push_thread_default(context);
+  hedge.loop = g_main_loop_new(context, FALSE);
+  hedge.js = js;
+  hedge.session = session;
+
+  expired = g_timeout_source_new(JS_HTTP_EXPIRED_INTERVAL);
+  g_source_set_callback(expired, _js_http_hedge_expired, &hedge, NULL);
+  g_source_attach(expired, context);
+
+  started = g_get_monotonic_time();
+  hedge.pending = 1;
+  soup_session_queue_message(session, g_object_ref(msg), _js_http_hedge_finished, &hedge);
+
+  /* schedule a duplicate request past the 95th percentile latency */
+  timer = NULL;
+  g_mutex_lock(&js->provider->lock);
+  delay = cio_provider_stats_percentile(&js->provider->http, 95);
+  g_mutex_unlock(&js->provider->lock);
+  if (delay >= 0)
+  {
+    uri = soup_uri_to_string(soup_message_get_uri(msg), FALSE);
+    hedge.hedge = soup_message_new(msg->method, uri);
+    soup_message_headers_foreach(msg->request_headers, _js_http_copy_header,
+				 hedge.hedge->request_headers);
+    g_free(uri);
+
+    timer = g_timeout_source_new(MAX(delay / 1000, JS_HTTP_MIN_HEDGE_DELAY));
+    g_source_set_callback(timer, _js_http_hedge_fire, &hedge, NULL);
+    g_source_attach(timer, context);
+  }
+
+  g_main_loop_run(hedge.loop);
+
+  /* cancel the slower request and wait for it to be finished */
+  if (timer)
+  {
+    g_source_destroy(timer);
+    g_source_unref(timer);
+  }
+  g_source_destroy(expired);
+  g_source_unref(expired);
+
+  soup_session_abort(session);
+  while (hedge.pending > 0)
+    g_main_context_iteration(context, TRUE);
+
+  if (hedge.winner == NULL)
+    hedge.winner = g_object_ref(msg);
+
+  status = hedge.winner->status_code;
+  g_mutex_lock(&js->provider->lock);
+  cio_provider_stats_record(&js->provider->http, g_get_monotonic_time() - started,
+			    status >= 100 && status < 500);
+  g_mutex_unlock(&js->provider->lock);
+
+  g_main_loop_unref(hedge.loop);
+  g_main_context_pop_thread_default(context);
+  g_main_context_unref(context);
+
+  if (hedge.hedge)
+    g_object_unref(hedge.hedge);
+
+  return hedge.winner;
+}
+
 static void
 _js_http_get(js_State *state)
 {
@@ -114,6 +270,7 @@ _js_http_get(js_State *state)
   JsonObject *object;
   GHashTable *params;
   const gchar *ctype;
+  SoupMessage *response;
 
   err = NULL;
   temp = NULL;
@@ -121,12 +278,19 @@ _js_http_get(js_State *state)
   params = NULL;
   js = js_touserdata(state, 0, "instance");
 
+  if (g_atomic_int_get(&js->expired))
+  {
+    js_error(state, "Time budget of call exceeded");
+    return;
+  }
+
   uri = js_tostring(state, 1);
   if (!js_isundefined(state, 2))
     headers = js_util_tojsonnode(state, 2);
 
   session = soup_session_new_with_options(SOUP_SESSION_ADD_FEATURE,
-					  SOUP_SESSION_FEATURE(js->provider->service->cache),
+					  SOUP_SESSION_FEATURE(js->cache),
+					  SOUP_SESSION_USE_THREAD_CONTEXT, TRUE,
 					  NULL);
 
   g_log(DOMAIN, G_LOG_LEVEL_DEBUG,
@@ -157,7 +321,19 @@ _js_http_get(js_State *state)
   }
 
 
-  status = soup_session_send_message(session, msg);
+  /* continue with the response of the request that finished first */
+  response = _js_http_send_hedged(js, session, msg);
+  g_object_unref(msg);
+  msg = response;
+  status = msg->status_code;
+
+  if (g_atomic_int_get(&js->expired))
+  {
+    g_object_unref(session);
+    g_object_unref(msg);
+    js_error(state, "Time budget of call exceeded");
+    return;
+  }
 
   params = NULL;
   ctype = soup_message_headers_get_content_type(msg->response_headers, &params);
@@ -206,7 +382,7 @@ _js_http_get(js_State *state)
     js_defproperty(state, -2, "body", JS_READONLY);
   }
 
-  soup_cache_flush(js->provider->service->cache);
+  soup_cache_flush(js->cache);
   g_object_unref(session);
   g_object_unref(msg);
   g_free(temp);
@@ -232,6 +408,12 @@ _js_http_post(js_State *state)
 
   js = js_touserdata(state, 0, "instance");
 
+  if (g_atomic_int_get(&js->expired))
+  {
+    js_error(state, "Time budget of call exceeded");
+    return;
+  }
+
   uri = js_tostring(state, 1);
 
   if (!js_isundefined(state, 2))
@@ -241,7 +423,7 @@ _js_http_post(js_State *state)
     content = js_tostring(state, 3);
 
   session = soup_session_new_with_options(SOUP_SESSION_ADD_FEATURE,
-					  SOUP_SESSION_FEATURE(js->provider->service->cache),
+					  SOUP_SESSION_FEATURE(js->cache),
 					  NULL);
 
   g_log(DOMAIN, G_LOG_LEVEL_DEBUG,
@@ -302,7 +484,7 @@ _js_http_post(js_State *state)
     js_defproperty(state, -2, "body", JS_READONLY);
   }
 
-  soup_cache_flush(js->provider->service->cache);
+  soup_cache_flush(js->cache);
   g_object_unref(session);
   g_object_unref(msg);
 }
@@ -22,6 +22,7 @@
 #define _js_h
 
 #include <json-glib/json-glib.h>
+#include <libsoup/soup.h>
 
 #include "mujs/mujs.h"
 #include "provider.h"
@@ -29,7 +30,39 @@
 typedef struct js_provider_t
 {
   js_State *state;
-  GList *paths;
+
+  /* registered paths routed to the registry key of handler */
+  struct cio_router_t *router;
+
+  /* registered paths which items may not be cached */
+  GList *uncached;
+
+  /* NULL terminated list of item types declared by the search
+     function, NULL if any type */
+  gchar **types;
+
+  /* search function takes the options argument with the offset */
+  gboolean paged;
+
+  /* http cache of the plugin instance in a directory not shared with
+     other live instances */
+  SoupCache *cache;
+
+  /* http cache directory of instance and time it was last used */
+  guint slot;
+  gint64 used;
+
+  /* bytes allocated by the state, its peak, the part added to the
+     provider usage and the limit, 0 if unlimited */
+  gsize memory;
+  gsize memory_peak;
+  gsize memory_reported;
+  gsize memory_limit;
+
+  /* monotonic time a call of the state must finish by, 0 if no call
+     is watched, and set by the watchdog when the call is overdue */
+  gint64 deadline;
+  gint expired;
   cio_provider_descriptor_t *provider;
 } js_provider_t;
 
@@ -42,5 +75,8 @@ void js_cache_init(js_State *state, js_provider_t *instance);
 /* util */
 void js_util_pushjsonnode(js_State *state, JsonNode *node);
 JsonNode *js_util_tojsonnode(js_State *state, int idx);
+/** append value at idx as compact json to out without building a
+    JsonNode tree, returns FALSE if the value is not serializable */
+gboolean js_util_tojson(js_State *state, int idx, GString *out);
 
 #endif /* _js_h */
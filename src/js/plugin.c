@@ -20,19 +20,47 @@
 
 #include <string.h>
 #include "js/js.h"
+#include "router.h"
 
 #define DOMAIN "provider"
 
 static void
 _js_plugin_search(js_State *state)
 {
+  int i, length;
+  GPtrArray *types;
   js_provider_t *js;
   js = js_touserdata(state, 0, "instance");
 
   g_log(DOMAIN, G_LOG_LEVEL_INFO,
 	"[%s.plugin.search]: register handler function for search.", js->provider->id);
 
+  /* store item types the search function can produce, the types of
+     provider are taken from the instance run when plugin is loaded */
+  if (js_isarray(state, 2))
+  {
+    types = g_ptr_array_new();
+    length = js_getlength(state, 2);
+    for (i = 0; i < length; i++)
+    {
+      js_getindex(state, 2, i);
+      g_ptr_array_add(types, g_strdup(js_tostring(state, -1)));
+      js_pop(state, 1);
+    }
+    g_ptr_array_add(types, NULL);
+
+    g_strfreev(js->types);
+    js->types = (gchar **)g_ptr_array_free(types, FALSE);
+  }
+
+  /* a search function declaring the options argument pages through
+     the result by its offset */
+  js_getproperty(state, 1, "length");
+  js->paged = (js_tonumber(state, -1) >= 3);
+  js_pop(state, 1);
+
   /* store search function in the registry */
+  js_copy(state, 1);
   js_setregistry(state, "plugin.search");
 
   /* return value */
@@ -51,19 +79,25 @@ _js_plugin_register(js_State *state)
   g_log(DOMAIN, G_LOG_LEVEL_INFO,
 	"[%s.plugin.register]: register enumeration uri '%s'", js->provider->id, uri);
 
-  /* verify that wildcard is used correctly */
-  if (strrchr(uri, '*') != NULL && uri[strlen(uri) - 1] != '*')
+  /* add uri to paths router, wildcard is only allowed at the end */
+  if (!cio_router_add(js->router, uri, g_strdup(uri)))
   {
     g_log(DOMAIN, G_LOG_LEVEL_WARNING,
-	  "[%s.plugin.register]: wildcard is not at the end of uri", js->provider->id);
+	  "[%s.plugin.register]: invalid uri '%s'", js->provider->id, uri);
     js_pushundefined(state);
     return;
   }
 
-  /* add uri to paths match */
-  js->paths = g_list_append(js->paths, g_strdup(uri));
+  /* keep uri of handler which items may not be cached */
+  if (js_isobject(state, 3) && js_hasproperty(state, 3, "cache"))
+  {
+    if (!js_toboolean(state, -1))
+      js->uncached = g_list_append(js->uncached, g_strdup(uri));
+    js_pop(state, 1);
+  }
 
   /* store uri in the registry */
+  js_copy(state, 2);
   js_setregistry(state, uri);
 
   /* return value */
@@ -72,11 +72,13 @@ _js_settings_get(js_State *state)
   js = js_touserdata(state, 0, "instance");
   id = js_tostring(state, 1);
 
-  value = cio_settings_get_value(js->provider->service->settings,
+  value = cio_settings_dup_value(js->provider->service->settings,
 				 js->provider->id, id, NULL);
 
   /* return value */
   js_util_pushjsonnode(state, value);
+  if (value)
+    json_node_free(value);
 }
 
 void
@@ -19,6 +19,7 @@
  */
 
 #include <stdio.h>
+#include <math.h>
 #include <js/js.h>
 
 void
@@ -46,6 +47,7 @@ js_util_pushjsonnode(js_State *state, JsonNode *node)
 JsonNode *
 js_util_tojsonnode(js_State *state, int idx)
 {
+  double value;
   const char *s;
   JsonNode *node;
   JsonNode *tmp;
@@ -62,7 +64,13 @@ js_util_tojsonnode(js_State *state, int idx)
 
   else if (js_isnumber(state, idx))
   {
-    json_node_init_int(node, js_tointeger(state, idx));
+    value = js_tonumber(state, idx);
+    if (isnan(value) || isinf(value))
+      json_node_init_null(node);
+    else if (value == floor(value) && fabs(value) < 1e15)
+      json_node_init_int(node, (gint64)value);
+    else
+      json_node_init_double(node, value);
   }
 
   else if (js_isboolean(state, idx))
@@ -123,6 +131,124 @@ js_util_tojsonnode(js_State *state, int idx)
   return node;
 }
 
+static void
+_js_util_tojson_string(GString *out, const char *s)
+{
+  g_string_append_c(out, '"');
+  for (; *s; s++)
+  {
+    switch (*s)
+    {
+    case '"': g_string_append(out, "\\\""); break;
+    case '\\': g_string_append(out, "\\\\"); break;
+    case '\b': g_string_append(out, "\\b"); break;
+    case '\f': g_string_append(out, "\\f"); break;
+    case '\n': g_string_append(out, "\\n"); break;
+    case '\r': g_string_append(out, "\\r"); break;
+    case '\t': g_string_append(out, "\\t"); break;
+    default:
+      if ((unsigned char)*s < 0x20)
+	g_string_append_printf(out, "\\u%04x", (unsigned char)*s);
+      else
+	g_string_append_c(out, *s);
+    }
+  }
+  g_string_append_c(out, '"');
+}
+
+static void
+_js_util_tojson_number(GString *out, double value)
+{
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  if (isnan(value) || isinf(value))
+    g_string_append(out, "null");
+  else if (value == floor(value) && fabs(value) < 1e15)
+    g_string_append_printf(out, "%" G_GINT64_FORMAT, (gint64)value);
+  else
+    g_string_append(out, g_ascii_dtostr(buf, sizeof(buf), value));
+}
+
+/** check if value at idx is serialized, same values as js_util_tojsonnode */
+static gboolean
+_js_util_tojson_value(js_State *state, int idx)
+{
+  return (js_isstring(state, idx) || js_isnumber(state, idx)
+	  || js_isboolean(state, idx) || js_isobject(state, idx));
+}
+
+gboolean
+js_util_tojson(js_State *state, int idx, GString *out)
+{
+  const char *s;
+  gboolean first;
+  unsigned int i, length;
+
+  /* children are pushed on the stack, use absolute index */
+  if (idx < 0)
+    idx = js_gettop(state) + idx;
+
+  if (js_isstring(state, idx))
+    _js_util_tojson_string(out, js_tostring(state, idx));
+
+  else if (js_isnumber(state, idx))
+    _js_util_tojson_number(out, js_tonumber(state, idx));
+
+  else if (js_isboolean(state, idx))
+    g_string_append(out, js_toboolean(state, idx) ? "true" : "false");
+
+  else if (js_isarray(state, idx))
+  {
+    g_string_append_c(out, '[');
+
+    first = TRUE;
+    length = js_getlength(state, idx);
+    for (i = 0; i < length; i++)
+    {
+      js_getindex(state, idx, i);
+      if (_js_util_tojson_value(state, -1))
+      {
+	if (!first)
+	  g_string_append_c(out, ',');
+	js_util_tojson(state, -1, out);
+	first = FALSE;
+      }
+      js_pop(state, 1);
+    }
+
+    g_string_append_c(out, ']');
+  }
+
+  else if (js_isobject(state, idx))
+  {
+    g_string_append_c(out, '{');
+
+    first = TRUE;
+    js_pushiterator(state, idx, 1);
+    while((s = js_nextiterator(state, -1)) != NULL)
+    {
+      js_getproperty(state, idx, s);
+      if (_js_util_tojson_value(state, -1))
+      {
+	if (!first)
+	  g_string_append_c(out, ',');
+	_js_util_tojson_string(out, s);
+	g_string_append_c(out, ':');
+	js_util_tojson(state, -1, out);
+	first = FALSE;
+      }
+      js_pop(state, 1);
+    }
+    js_pop(state, 1);
+
+    g_string_append_c(out, '}');
+  }
+
+  else
+    return FALSE;
+
+  return TRUE;
+}
 
 void
 js_util_dumpstack(js_State *state, int depth)
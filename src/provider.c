@@ -18,8 +18,7 @@
  *
  */
 
-#include <archive.h>
-#include <archive_entry.h>
+#include <stdlib.h>
 #include <string.h>
 #include <glib.h>
 
@@ -28,11 +27,696 @@
 #include "service.h"
 #include "settings.h"
 #include "provider.h"
+#include "index.h"
+#include "suggest.h"
+#include "response.h"
 #include "providers/plugin.h"
 #include "providers/movie_library.h"
 
 #define DOMAIN "provider"
 
+/* weight of a new sample in latency average */
+#define PROVIDER_STATS_EWMA_ALPHA 0.2
+
+/* minimum number of samples for a latency percentile */
+#define PROVIDER_STATS_MIN_SAMPLES 16
+
+/* consecutive failures which opens the circuit breaker */
+#define PROVIDER_BREAKER_THRESHOLD 5
+
+/* initial and maximum seconds the circuit breaker is open */
+#define PROVIDER_BREAKER_BACKOFF 30
+#define PROVIDER_BREAKER_MAX_BACKOFF 300
+
+/* maximum number of item responses cached for a provider */
+#define PROVIDER_RESPONSES_MAX 256
+
+/* maximum number of worker threads of a provider */
+#define PROVIDER_MAX_WORKERS 16
+
+/* maximum number of folders of a listing to prefetch */
+#define PROVIDER_PREFETCH_FOLDERS 3
+
+/* maximum number of clients which request generations are kept */
+#define PROVIDER_SESSIONS_MAX 256
+
+/* a cached item response, buffer is NULL while it is produced and
+   identical requests are waiting for it */
+typedef struct _provider_response_t
+{
+  SoupBuffer *buffer;
+  gint64 expires;
+  GList *waiters;
+} _provider_response_t;
+
+/* an item listing or a search produced on the worker thread of a
+   provider */
+typedef struct _provider_task_t
+{
+  cio_provider_descriptor_t *provider;
+  gchar *path;
+  gsize offset;
+  gsize limit;
+
+  /* search performed instead of a listing if done is set */
+  gchar *keywords;
+  gchar **types;
+  cio_provider_search_done_callback_t done;
+  gpointer user_data;
+  JsonArray *items;
+
+  /* members of items requested, NULL for all members */
+  gchar **fields;
+
+  /* response cache key, NULL if response is not cached */
+  gchar *key;
+  gint ttl;
+  _provider_response_t *response;
+
+  /* client session of the request, a prefetch is skipped if the
+     client made a newer request to provider */
+  gchar *session;
+  guint generation;
+  gboolean prefetch;
+  gboolean skipped;
+
+  /* listing produced by worker, content is the response and data the
+     serialized items with the members of each item in entries, data
+     is NULL if content holds the items. failed if the provider failed
+     rather than having no items of path */
+  gboolean found;
+  gchar *content;
+  gchar *data;
+  GPtrArray *entries;
+  gint64 elapsed;
+  gboolean failed;
+} _provider_task_t;
+
+/* a paused request waiting for a response that is produced */
+typedef struct _provider_waiter_t
+{
+  _provider_response_t *response;
+  SoupServer *server;
+  SoupMessage *msg;
+  gboolean pretty;
+} _provider_waiter_t;
+
+static void
+_provider_response_send(SoupServer *server, SoupMessage *msg, SoupBuffer *buffer,
+			gboolean pretty)
+{
+  cio_response_json_buffer(server, msg, buffer, pretty);
+  soup_message_set_status(msg, SOUP_STATUS_OK);
+}
+
+static void
+_provider_waiter_finished(SoupMessage *msg, gpointer user_data)
+{
+  _provider_waiter_t *waiter;
+  waiter = (_provider_waiter_t *)user_data;
+
+  waiter->response->waiters = g_list_remove(waiter->response->waiters, waiter);
+  g_free(waiter);
+}
+
+/** pause request until response is produced */
+static void
+_provider_response_wait(_provider_response_t *response, SoupServer *server,
+			SoupMessage *msg, gboolean pretty)
+{
+  _provider_waiter_t *waiter;
+
+  waiter = g_new0(_provider_waiter_t, 1);
+  waiter->response = response;
+  waiter->server = server;
+  waiter->msg = msg;
+  waiter->pretty = pretty;
+  g_signal_connect(msg, "finished", G_CALLBACK(_provider_waiter_finished), waiter);
+  response->waiters = g_list_append(response->waiters, waiter);
+  soup_server_pause_message(server, msg);
+}
+
+/** answer the requests waiting for response, with status if the
+    response could not be produced */
+static void
+_provider_response_complete(_provider_response_t *response, guint status)
+{
+  _provider_waiter_t *waiter;
+
+  while (response->waiters)
+  {
+    waiter = response->waiters->data;
+    response->waiters = g_list_delete_link(response->waiters, response->waiters);
+
+    g_signal_handlers_disconnect_by_data(waiter->msg, waiter);
+    if (response->buffer)
+      _provider_response_send(waiter->server, waiter->msg, response->buffer,
+				waiter->pretty);
+    else
+      soup_message_set_status(waiter->msg, status);
+
+    soup_server_unpause_message(waiter->server, waiter->msg);
+    g_free(waiter);
+  }
+}
+
+static void
+_provider_response_free(_provider_response_t *response)
+{
+  _provider_response_complete(response, SOUP_STATUS_SERVICE_UNAVAILABLE);
+  if (response->buffer)
+    soup_buffer_free(response->buffer);
+  g_free(response);
+}
+
+static gboolean
+_provider_response_expired(gpointer key, gpointer value, gpointer user_data)
+{
+  _provider_response_t *response;
+  response = (_provider_response_t *)value;
+  return response->buffer && response->expires <= *(gint64 *)user_data;
+}
+
+/** get a cached response of key or add a response to be produced,
+    NULL if the cache is full */
+static _provider_response_t *
+_provider_response_lookup(cio_provider_descriptor_t *provider, const gchar *key,
+			  gboolean *hit)
+{
+  gint64 now;
+  _provider_response_t *response;
+
+  now = g_get_monotonic_time();
+  response = g_hash_table_lookup(provider->responses, key);
+  if (response && (response->buffer == NULL || response->expires > now))
+  {
+    *hit = TRUE;
+    return response;
+  }
+
+  *hit = FALSE;
+  if (response)
+    g_hash_table_remove(provider->responses, key);
+
+  if (g_hash_table_size(provider->responses) >= PROVIDER_RESPONSES_MAX)
+    g_hash_table_foreach_remove(provider->responses, _provider_response_expired, &now);
+
+  if (g_hash_table_size(provider->responses) >= PROVIDER_RESPONSES_MAX)
+    return NULL;
+
+  response = g_new0(_provider_response_t, 1);
+  g_hash_table_insert(provider->responses, g_strdup(key), response);
+  return response;
+}
+
+static gchar *
+_provider_items_to_data(JsonNode *result)
+{
+  gchar *content;
+  JsonGenerator *generator;
+
+  generator = json_generator_new();
+  json_generator_set_root(generator, result);
+  content = json_generator_to_data(generator, NULL);
+  g_object_unref(generator);
+
+  return content;
+}
+
+/** serialize result with each item of an array at the offset kept
+    with the members of the item in entries */
+static gchar *
+_provider_items_summarize(JsonNode *result, GPtrArray **entries)
+{
+  guint i;
+  gsize length;
+  gchar *content;
+  GString *out;
+  JsonArray *items;
+  JsonGenerator *generator;
+  cio_provider_item_t *entry;
+
+  *entries = NULL;
+  if (!JSON_NODE_HOLDS_ARRAY(result))
+    return _provider_items_to_data(result);
+
+  *entries = g_ptr_array_new_with_free_func((GDestroyNotify)cio_provider_item_free);
+  items = json_node_get_array(result);
+  generator = json_generator_new();
+  out = g_string_new("[");
+
+  for (i = 0; i < json_array_get_length(items); i++)
+  {
+    if (i)
+      g_string_append_c(out, ',');
+
+    json_generator_set_root(generator, json_array_get_element(items, i));
+    content = json_generator_to_data(generator, &length);
+
+    entry = cio_provider_item_new(json_array_get_element(items, i));
+    if (entry)
+    {
+      entry->offset = out->len;
+      entry->length = length;
+      g_ptr_array_add(*entries, entry);
+    }
+
+    g_string_append_len(out, content, length);
+    g_free(content);
+  }
+
+  g_string_append_c(out, ']');
+  g_object_unref(generator);
+
+  return g_string_free(out, FALSE);
+}
+
+/** get cache lifetime in seconds for items of path, 0 if not cacheable */
+static gint
+_provider_items_ttl(cio_provider_descriptor_t *provider, const gchar *path)
+{
+  gint ttl;
+  GError *err;
+
+  err = NULL;
+  ttl = cio_settings_get_int_value(provider->service->settings,
+				   provider->id, "cache_ttl", &err);
+  if (err)
+  {
+    g_clear_error(&err);
+    return 0;
+  }
+
+  if (provider->cacheable && !provider->cacheable(provider, path))
+    return 0;
+
+  return MAX(ttl, 0);
+}
+
+/** get number of worker threads of provider */
+static gint
+_provider_workers(cio_provider_descriptor_t *provider)
+{
+  gint workers;
+
+  workers = cio_settings_get_int_value(provider->service->settings,
+				       provider->id, "workers", NULL);
+  return CLAMP(workers, 1, PROVIDER_MAX_WORKERS);
+}
+
+static _provider_task_t *
+_provider_task_new(cio_provider_descriptor_t *provider, const gchar *path,
+		   gsize offset, gsize limit, gchar **fields)
+{
+  _provider_task_t *task;
+
+  task = g_new0(_provider_task_t, 1);
+  task->provider = cio_provider_ref(provider);
+  task->path = g_strdup(path);
+  task->offset = offset;
+  task->limit = limit;
+  task->fields = g_strdupv(fields);
+
+  return task;
+}
+
+/** start the next generation of the requests of client session to
+    provider, prefetches queued for an older generation are skipped */
+static guint
+_provider_session_next(cio_provider_descriptor_t *provider, const gchar *session)
+{
+  guint generation;
+
+  g_mutex_lock(&provider->lock);
+
+  if (g_hash_table_size(provider->sessions) >= PROVIDER_SESSIONS_MAX
+      && !g_hash_table_contains(provider->sessions, session))
+    g_hash_table_remove_all(provider->sessions);
+
+  generation = GPOINTER_TO_UINT(g_hash_table_lookup(provider->sessions, session)) + 1;
+  g_hash_table_replace(provider->sessions, g_strdup(session),
+		       GUINT_TO_POINTER(generation));
+
+  g_mutex_unlock(&provider->lock);
+  return generation;
+}
+
+static guint
+_provider_session_generation(cio_provider_descriptor_t *provider, const gchar *session)
+{
+  guint generation;
+
+  g_mutex_lock(&provider->lock);
+  generation = GPOINTER_TO_UINT(g_hash_table_lookup(provider->sessions, session));
+  g_mutex_unlock(&provider->lock);
+
+  return generation;
+}
+
+/** get response cache key of the listing of task */
+static gchar *
+_provider_task_key(_provider_task_t *task)
+{
+  gchar *key;
+  gchar *fields;
+
+  fields = task->fields ? g_strjoinv(",", task->fields) : NULL;
+  key = g_strdup_printf("%s\n%" G_GSIZE_FORMAT "\n%" G_GSIZE_FORMAT "\n%s",
+			task->path, task->offset, task->limit,
+			fields ? fields : "");
+  g_free(fields);
+
+  return key;
+}
+
+/** serialize the requested members of items in result */
+static gchar *
+_provider_items_project(JsonNode *result, gchar **fields)
+{
+  guint i;
+  gchar *content;
+  JsonNode *node;
+  JsonArray *items, *array;
+
+  if (!JSON_NODE_HOLDS_ARRAY(result))
+    return _provider_items_to_data(result);
+
+  items = json_node_get_array(result);
+  array = json_array_new();
+  for (i = 0; i < json_array_get_length(items); i++)
+    json_array_add_element(array, cio_response_project(json_array_get_element(items, i),
+							fields));
+
+  node = json_node_alloc();
+  json_node_init_array(node, array);
+  content = _provider_items_to_data(node);
+  json_node_free(node);
+  json_array_unref(array);
+
+  return content;
+}
+
+static void
+_provider_task_free(_provider_task_t *task)
+{
+  cio_provider_unref(task->provider);
+  g_free(task->path);
+  g_free(task->keywords);
+  g_strfreev(task->types);
+  if (task->items)
+    json_array_unref(task->items);
+  g_free(task->content);
+  g_free(task->data);
+  if (task->entries)
+    g_ptr_array_unref(task->entries);
+  g_strfreev(task->fields);
+  g_free(task->session);
+  g_free(task->key);
+  g_free(task);
+}
+
+/** client requests are performed before prefetches */
+static gint
+_provider_task_compare(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  const _provider_task_t *ta, *tb;
+
+  ta = (const _provider_task_t *)a;
+  tb = (const _provider_task_t *)b;
+
+  return ta->prefetch - tb->prefetch;
+}
+
+static gboolean _provider_task_done(gpointer user_data);
+
+/** collect the items of a search on the worker thread */
+static int
+_provider_search_collect(cio_provider_descriptor_t *provider, JsonNode *item,
+			 gpointer user_data)
+{
+  if (item)
+    json_array_add_element((JsonArray *)user_data, json_node_copy(item));
+  return 0;
+}
+
+/** pass the items of a search to the caller on the main loop */
+static gboolean
+_provider_search_done(gpointer user_data)
+{
+  _provider_task_t *task;
+
+  task = (_provider_task_t *)user_data;
+  task->done(task->provider, task->items, task->elapsed, task->user_data);
+  _provider_task_free(task);
+
+  return FALSE;
+}
+
+/** get items from provider on the worker thread of provider, the
+    task is finished on the main loop */
+static void
+_provider_task_run(gpointer data, gpointer user_data)
+{
+  gint64 started;
+  GError *err;
+  JsonNode *result;
+  _provider_task_t *task;
+  cio_provider_descriptor_t *provider;
+
+  task = (_provider_task_t *)data;
+  provider = task->provider;
+  err = NULL;
+
+  if (task->done)
+  {
+    started = g_get_monotonic_time();
+    task->items = json_array_new();
+    if (provider->search == NULL
+	|| !provider->search(provider, task->keywords, task->types,
+			     task->offset, (gssize)task->limit,
+			     _provider_search_collect, task->items))
+    {
+      json_array_unref(task->items);
+      task->items = NULL;
+    }
+    task->elapsed = g_get_monotonic_time() - started;
+
+    g_idle_add(_provider_search_done, task);
+    return;
+  }
+
+  /* skip prefetch of a listing the client has left */
+  if (task->prefetch
+      && task->generation != _provider_session_generation(provider, task->session))
+  {
+    task->skipped = TRUE;
+    g_idle_add(_provider_task_done, task);
+    return;
+  }
+
+  /* a provider serializing its items passes them without a tree of
+     the listing */
+  started = g_get_monotonic_time();
+  if (provider->items_data && task->fields == NULL)
+    task->found = provider->items_data(provider, task->path, task->offset, task->limit,
+				       &task->content, &task->entries, &err);
+  else
+  {
+    result = provider->items(provider, task->path, task->offset, task->limit, &err);
+    if (result)
+    {
+      task->content = _provider_items_summarize(result, &task->entries);
+      if (task->fields)
+      {
+	task->data = task->content;
+	task->content = _provider_items_project(result, task->fields);
+      }
+      json_node_free(result);
+      task->found = TRUE;
+    }
+  }
+  task->elapsed = g_get_monotonic_time() - started;
+
+  if (err)
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	  "Provider '%s' failed to get items of '%s': %s",
+	  provider->id, task->path, err->message);
+    task->failed = TRUE;
+    g_clear_error(&err);
+  }
+
+  g_idle_add(_provider_task_done, task);
+}
+
+/** queue prefetch of a listing for the client session of origin,
+    returns FALSE if the listing is not fetched */
+static gboolean
+_provider_prefetch_add(_provider_task_t *origin, const gchar *path, gsize offset)
+{
+  gint ttl;
+  gboolean hit;
+  _provider_task_t *task;
+  _provider_response_t *response;
+  cio_provider_descriptor_t *provider;
+
+  provider = origin->provider;
+  ttl = _provider_items_ttl(provider, path);
+  if (ttl == 0)
+    return FALSE;
+
+  task = _provider_task_new(provider, path, offset, origin->limit, origin->fields);
+  task->key = _provider_task_key(task);
+
+  /* skip listing that is cached or being produced */
+  response = _provider_response_lookup(provider, task->key, &hit);
+  if (response == NULL || hit)
+  {
+    _provider_task_free(task);
+    return FALSE;
+  }
+
+  g_log(DOMAIN, G_LOG_LEVEL_DEBUG,
+	"Prefetching items of '%s' from provider '%s'.", path, provider->id);
+
+  task->ttl = ttl;
+  task->response = response;
+  task->prefetch = TRUE;
+  task->session = g_strdup(origin->session);
+  task->generation = origin->generation;
+  provider->prefetches++;
+  g_thread_pool_push(provider->pool, task, NULL);
+
+  return TRUE;
+}
+
+/** prefetch the next page and the first folders of the listing of
+    task, the prefetch budget limits the listings queued for prefetch
+    by provider */
+static void
+_provider_prefetch_queue(_provider_task_t *task)
+{
+  guint i;
+  guint folders;
+  gint budget;
+  gchar *prefix;
+  GPtrArray *entries;
+  cio_provider_item_t *entry;
+  cio_provider_descriptor_t *provider;
+  GError *err;
+
+  err = NULL;
+  provider = task->provider;
+  entries = task->entries;
+  budget = cio_settings_get_int_value(provider->service->settings,
+				      provider->id, "prefetch", &err);
+  budget -= (gint)provider->prefetches;
+  if (err || budget <= 0 || entries == NULL)
+  {
+    g_clear_error(&err);
+    return;
+  }
+
+  /* a full page means that there may be a next page */
+  if (entries->len >= task->limit
+      && _provider_prefetch_add(task, task->path, task->offset + task->limit))
+    budget--;
+
+  /* folders linking items of this provider */
+  prefix = g_strdup_printf("/providers/%s/", provider->id);
+  folders = 0;
+  for (i = 0; i < entries->len && budget > 0
+	 && folders < PROVIDER_PREFETCH_FOLDERS; i++)
+  {
+    entry = g_ptr_array_index(entries, i);
+    if (g_strcmp0(entry->type, "folder") != 0
+	|| entry->uri == NULL || !g_str_has_prefix(entry->uri, prefix))
+      continue;
+
+    if (_provider_prefetch_add(task, entry->uri + strlen(prefix), 0))
+      budget--;
+    folders++;
+  }
+  g_free(prefix);
+}
+
+/** finish a task on the main loop, answering the requests waiting
+    for the listing */
+static gboolean
+_provider_task_done(gpointer user_data)
+{
+  guint i;
+  const gchar *data;
+  cio_provider_item_t *entry;
+  _provider_task_t *task;
+  cio_provider_descriptor_t *provider;
+
+  task = (_provider_task_t *)user_data;
+  provider = task->provider;
+
+  if (task->prefetch)
+    provider->prefetches--;
+
+  /* a skipped prefetch is performed if a client is waiting for it */
+  if (task->skipped)
+  {
+    if (task->response->waiters)
+    {
+      task->skipped = FALSE;
+      task->prefetch = FALSE;
+      g_thread_pool_push(provider->pool, task, NULL);
+      return FALSE;
+    }
+
+    g_hash_table_remove(provider->responses, task->key);
+    _provider_task_free(task);
+    return FALSE;
+  }
+
+  /* a path without items is not a failure of provider */
+  if ((task->found || task->failed)
+      && cio_provider_stats_record(&provider->stats, task->elapsed, !task->failed))
+    g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	  "Provider '%s' failed repeatedly, requests are short-circuited.",
+	  provider->id);
+
+  if (task->found)
+  {
+    /* add browsed items to the index and suggestions */
+    data = task->data ? task->data : task->content;
+    for (i = 0; task->entries && i < task->entries->len; i++)
+    {
+      entry = g_ptr_array_index(task->entries, i);
+      cio_index_add_data(provider->service->index, provider->id,
+			 data + entry->offset, entry);
+      cio_suggest_add_title(provider->service->suggest, entry->title);
+    }
+
+    /* fetch the listings client may browse next */
+    if (task->key && !task->prefetch)
+      _provider_prefetch_queue(task);
+
+    task->response->buffer = soup_buffer_new(SOUP_MEMORY_TAKE, task->content,
+					     strlen(task->content));
+    task->content = NULL;
+    task->response->expires = g_get_monotonic_time() + (gint64)task->ttl * G_USEC_PER_SEC;
+    _provider_response_complete(task->response, SOUP_STATUS_OK);
+  }
+  else if (task->failed)
+    _provider_response_complete(task->response, SOUP_STATUS_BAD_GATEWAY);
+  else
+    _provider_response_complete(task->response, SOUP_STATUS_NOT_FOUND);
+
+  /* keep only a successful response of a cacheable listing */
+  if (task->key == NULL)
+    _provider_response_free(task->response);
+  else if (!task->found)
+    g_hash_table_remove(provider->responses, task->key);
+
+  _provider_task_free(task);
+  return FALSE;
+}
+
 cio_provider_descriptor_t *
 cio_provider_instance(cio_service_t *service, cio_provider_type_t type, const gchar *args)
 {
@@ -59,6 +743,7 @@ cio_provider_instance(cio_service_t *service, cio_provider_type_t type, const gc
 
 
   provider->service = service;
+  provider->ref = 1;
 
   /* add provider setting 'enabled' if not exists */
   if (!cio_settings_has_value(service->settings,
@@ -72,16 +757,234 @@ cio_provider_instance(cio_service_t *service, cio_provider_type_t type, const gc
 			      value, NULL);
   }
 
+  /* add provider setting 'cache_ttl' if not exists */
+  if (!cio_settings_has_value(service->settings,
+			      provider->id, "cache_ttl"))
+  {
+    value = json_node_init_int(json_node_alloc(), 300);
+    cio_settings_create_value(service->settings,
+			      provider->id, "cache_ttl",
+			      "Cache lifetime",
+			      "Seconds a list of items is reused for identical requests,"
+			      " 0 disables the cache.",
+			      value, NULL);
+    json_node_free(value);
+  }
+
+  /* add provider setting 'prefetch' if not exists */
+  if (!cio_settings_has_value(service->settings,
+			      provider->id, "prefetch"))
+  {
+    value = json_node_init_int(json_node_alloc(), 4);
+    cio_settings_create_value(service->settings,
+			      provider->id, "prefetch",
+			      "Prefetch",
+			      "Number of item lists, next pages and folders of browsed"
+			      " lists, fetched ahead at a time, 0 disables prefetch.",
+			      value, NULL);
+    json_node_free(value);
+  }
+
+  provider->responses = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					      (GDestroyNotify)_provider_response_free);
+  provider->sessions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  /* add provider setting 'workers' if not exists */
+  if (!cio_settings_has_value(service->settings,
+			      provider->id, "workers"))
+  {
+    value = json_node_init_int(json_node_alloc(), 2);
+    cio_settings_create_value(service->settings,
+			      provider->id, "workers",
+			      "Workers",
+			      "Number of requests performed concurrently by the provider.",
+			      value, NULL);
+    json_node_free(value);
+  }
+
+  /* items are produced by worker threads of provider */
+  g_mutex_init(&provider->lock);
+  provider->pool = g_thread_pool_new(_provider_task_run, NULL,
+				     _provider_workers(provider), FALSE, NULL);
+  g_thread_pool_set_sort_function(provider->pool, _provider_task_compare, NULL);
+
   return provider;
 }
 
 void
 cio_provider_destroy(struct cio_provider_descriptor_t *provider)
 {
+  g_thread_pool_free(provider->pool, TRUE, TRUE);
+  g_mutex_clear(&provider->lock);
+  g_hash_table_destroy(provider->responses);
+  g_hash_table_destroy(provider->sessions);
+
   if (provider->destroy)
     provider->destroy(provider);
 }
 
+void
+cio_provider_search_queue(cio_provider_descriptor_t *provider,
+			  const gchar *keywords, gchar **types,
+			  gsize offset, gssize limit,
+			  cio_provider_search_done_callback_t done,
+			  gpointer user_data)
+{
+  _provider_task_t *task;
+
+  task = _provider_task_new(provider, NULL, offset, limit, NULL);
+  task->keywords = g_strdup(keywords);
+  task->types = g_strdupv(types);
+  task->done = done;
+  task->user_data = user_data;
+
+  if (g_thread_pool_get_max_threads(provider->pool) != _provider_workers(provider))
+    g_thread_pool_set_max_threads(provider->pool, _provider_workers(provider), NULL);
+  g_thread_pool_push(provider->pool, task, NULL);
+}
+
+static gchar *
+_provider_item_string(JsonObject *object, const gchar *member)
+{
+  JsonNode *node;
+
+  if (object == NULL || !json_object_has_member(object, member))
+    return NULL;
+
+  node = json_object_get_member(object, member);
+  if (!JSON_NODE_HOLDS_VALUE(node) || json_node_get_value_type(node) != G_TYPE_STRING)
+    return NULL;
+
+  return g_strdup(json_node_get_string(node));
+}
+
+cio_provider_item_t *
+cio_provider_item_new(JsonNode *item)
+{
+  JsonNode *node;
+  JsonObject *object, *metadata;
+  cio_provider_item_t *entry;
+
+  if (item == NULL || !JSON_NODE_HOLDS_OBJECT(item))
+    return NULL;
+
+  object = json_node_get_object(item);
+  entry = g_new0(cio_provider_item_t, 1);
+  entry->uri = _provider_item_string(object, "uri");
+  entry->type = _provider_item_string(object, "type");
+
+  node = json_object_get_member(object, "metadata");
+  if (node && JSON_NODE_HOLDS_OBJECT(node))
+  {
+    metadata = json_node_get_object(node);
+    entry->title = _provider_item_string(metadata, "title");
+    entry->artist = _provider_item_string(metadata, "artist");
+    entry->description = _provider_item_string(metadata, "description");
+  }
+
+  return entry;
+}
+
+void
+cio_provider_item_free(cio_provider_item_t *item)
+{
+  g_free(item->uri);
+  g_free(item->type);
+  g_free(item->title);
+  g_free(item->artist);
+  g_free(item->description);
+  g_free(item);
+}
+
+cio_provider_descriptor_t *
+cio_provider_ref(cio_provider_descriptor_t *provider)
+{
+  g_atomic_int_inc(&provider->ref);
+  return provider;
+}
+
+void
+cio_provider_unref(cio_provider_descriptor_t *provider)
+{
+  if (g_atomic_int_dec_and_test(&provider->ref))
+    cio_provider_destroy(provider);
+}
+
+gboolean
+cio_provider_stats_record(cio_provider_stats_t *stats, gint64 usec, gboolean success)
+{
+  stats->samples[stats->requests % CIO_PROVIDER_STATS_SAMPLES] = usec;
+  if (stats->requests == 0)
+    stats->ewma = usec;
+  else
+    stats->ewma += PROVIDER_STATS_EWMA_ALPHA * (usec - stats->ewma);
+  stats->requests++;
+
+  if (success)
+  {
+    stats->consecutive = 0;
+    stats->open_until = 0;
+    stats->backoff = 0;
+    return FALSE;
+  }
+
+  stats->failures++;
+  stats->consecutive++;
+  if (stats->consecutive < PROVIDER_BREAKER_THRESHOLD)
+    return FALSE;
+
+  /* open circuit breaker, doubling the time for each failed trial */
+  if (stats->backoff == 0)
+    stats->backoff = PROVIDER_BREAKER_BACKOFF * G_USEC_PER_SEC;
+  else
+    stats->backoff = MIN(stats->backoff * 2, PROVIDER_BREAKER_MAX_BACKOFF * G_USEC_PER_SEC);
+  stats->open_until = g_get_monotonic_time() + stats->backoff;
+  return TRUE;
+}
+
+static gint
+_provider_compare_samples(gconstpointer a, gconstpointer b)
+{
+  gint64 sa, sb;
+  sa = *(const gint64 *)a;
+  sb = *(const gint64 *)b;
+  return (sa > sb) - (sa < sb);
+}
+
+gint64
+cio_provider_stats_percentile(cio_provider_stats_t *stats, guint percentile)
+{
+  guint n;
+  gint64 samples[CIO_PROVIDER_STATS_SAMPLES];
+
+  n = MIN(stats->requests, CIO_PROVIDER_STATS_SAMPLES);
+  if (n < PROVIDER_STATS_MIN_SAMPLES)
+    return -1;
+
+  memcpy(samples, stats->samples, n * sizeof(gint64));
+  qsort(samples, n, sizeof(gint64), _provider_compare_samples);
+
+  return samples[MIN(n - 1, (n * percentile) / 100)];
+}
+
+gboolean
+cio_provider_stats_allow(cio_provider_stats_t *stats)
+{
+  gint64 now;
+
+  if (stats->open_until == 0)
+    return TRUE;
+
+  now = g_get_monotonic_time();
+  if (now < stats->open_until)
+    return FALSE;
+
+  /* half open, let one trial request through and keep others out
+     until it is finished */
+  stats->open_until = now + stats->backoff;
+  return TRUE;
+}
+
 void
 cio_provider_request_handler(SoupServer *server, SoupMessage *msg, const char *path,
 			     GHashTable *query, SoupClientContext *client,
@@ -91,17 +994,26 @@ cio_provider_request_handler(SoupServer *server, SoupMessage *msg, const char *p
   gboolean enabled;
   gchar *spath;
   gchar **components;
-  static gchar *content = "{}";
   cio_service_t *service;
   cio_provider_descriptor_t *provider;
-  JsonGenerator *generator;
-  JsonNode *result;
   gsize offset, limit;
   gchar *value;
+  gint ttl;
+  gchar *key;
+  gchar **fields;
+  gboolean hit;
+  guint generation;
+  const gchar *session;
+  _provider_task_t *task;
+  _provider_response_t *response;
 
   service = (cio_service_t *)user_data;
   err = NULL;
   components = NULL;
+  spath = NULL;
+  key = NULL;
+  fields = NULL;
+  response = NULL;
 
   /* this handler only supports GET methods */
   if (msg->method != SOUP_METHOD_GET)
@@ -155,31 +1067,82 @@ cio_provider_request_handler(SoupServer *server, SoupMessage *msg, const char *p
       limit = g_ascii_strtoll(value, NULL, 10);
   }
 
-  /* get items from provider */
   spath = g_strjoinv("/", components + 3);
-  result = provider->items(provider, spath, offset, limit);
-  if (result)
-  {
-    /* convert result into json text */
-    generator = json_generator_new();
-    json_generator_set_pretty(generator, TRUE);
-    json_generator_set_root(generator, result);
-    content = json_generator_to_data(generator, NULL);
-    g_object_unref(generator);
-    json_node_free(result);
-
-    /* send result */
-    soup_message_set_response(msg,
-			      "application/json; charset=utf-8",
-			      SOUP_MEMORY_TAKE,
-			      content,
-			      strlen(content));
-    soup_message_set_status(msg, SOUP_STATUS_OK);
+
+  /* queued prefetches of this client are of a listing it has left */
+  session = soup_client_context_get_host(client);
+  if (session == NULL)
+    session = "";
+  generation = _provider_session_next(provider, session);
+
+  fields = cio_response_fields(query);
+  task = _provider_task_new(provider, spath, offset, limit, fields);
+  task->session = g_strdup(session);
+  task->generation = generation;
+
+  /* use a cached response or wait for an identical request that
+     produces it */
+  ttl = _provider_items_ttl(provider, spath);
+  if (ttl > 0)
+  {
+    key = _provider_task_key(task);
+    response = _provider_response_lookup(provider, key, &hit);
+    if (hit && response->buffer)
+    {
+      _provider_response_send(server, msg, response->buffer,
+			      cio_response_pretty(query));
+      _provider_task_free(task);
+      goto finished;
+    }
+    else if (hit)
+    {
+      _provider_response_wait(response, server, msg, cio_response_pretty(query));
+      _provider_task_free(task);
+      goto finished;
+    }
+  }
+
+  /* bail out while provider is failing repeatedly */
+  if (!cio_provider_stats_allow(&provider->stats))
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_INFO,
+	  "Provider '%s' is unavailable, request short-circuited.", provider->id);
+    soup_message_headers_append(msg->response_headers, "Retry-After", "30");
+    soup_message_set_status(msg, SOUP_STATUS_SERVICE_UNAVAILABLE);
+
+    if (response)
+    {
+      _provider_response_complete(response, SOUP_STATUS_SERVICE_UNAVAILABLE);
+      g_hash_table_remove(provider->responses, key);
+    }
+    _provider_task_free(task);
+    goto finished;
+  }
+
+  /* get items on the worker thread of provider and answer request
+     when they are produced */
+  task->ttl = ttl;
+  if (response)
+  {
+    task->key = key;
+    key = NULL;
   }
   else
-    soup_message_set_status(msg, SOUP_STATUS_NOT_FOUND);
+    response = g_new0(_provider_response_t, 1);
+
+  task->response = response;
+  _provider_response_wait(response, server, msg, cio_response_pretty(query));
+
+  /* follow changes of the workers setting */
+  if (g_thread_pool_get_max_threads(provider->pool) != _provider_workers(provider))
+    g_thread_pool_set_max_threads(provider->pool, _provider_workers(provider), NULL);
+  g_thread_pool_push(provider->pool, task, NULL);
 
 finished:
+  g_clear_error(&err);
+  g_strfreev(fields);
+  g_free(key);
+  g_free(spath);
   if (components)
     g_strfreev(components);
 }
@@ -28,9 +28,59 @@
 struct cio_service_t;
 struct cio_provider_descriptor_t;
 
+/** error of a provider which failed to produce items, a path which
+    has no items is not an error */
+#define CIO_PROVIDER_ERROR g_quark_from_static_string("provider")
+
+/** search item callback, item is owned by the provider and must be
+    copied if kept. A NULL item marks the end of provider search. */
 typedef int (*cio_provider_search_on_item_callback_t)(struct cio_provider_descriptor_t *self,
 						      JsonNode *item, gpointer user_data);
 
+/** search done callback on the main loop with the items of a search
+    performed on a worker thread of provider, items is NULL if the
+    search failed and must be referenced if kept */
+typedef void (*cio_provider_search_done_callback_t)(struct cio_provider_descriptor_t *self,
+						    JsonArray *items, gint64 elapsed,
+						    gpointer user_data);
+
+/** members of an item of a listing used by the index, suggestions
+    and prefetch, taken from the item when the listing is serialized
+    and with the item serialized at offset of the listing data */
+typedef struct cio_provider_item_t
+{
+  gsize offset;
+  gsize length;
+
+  gchar *uri;
+  gchar *type;
+  gchar *title;
+  gchar *artist;
+  gchar *description;
+} cio_provider_item_t;
+
+/* number of latency samples kept for percentiles */
+#define CIO_PROVIDER_STATS_SAMPLES 64
+
+/** latency and error tracking of provider requests with a circuit
+    breaker that short-circuits a failing provider */
+typedef struct cio_provider_stats_t
+{
+  /* exponentially weighted moving average latency in usec */
+  gdouble ewma;
+
+  /* ring of latest latencies in usec */
+  gint64 samples[CIO_PROVIDER_STATS_SAMPLES];
+
+  guint requests;
+  guint failures;
+  guint consecutive;
+
+  /* circuit breaker is open until monotonic time */
+  gint64 open_until;
+  gint64 backoff;
+} cio_provider_stats_t;
+
 typedef enum cio_provider_type_t
 {
   CIO_PROVIDER_MOVIE_LIBRARY,
@@ -50,23 +100,78 @@ typedef struct cio_provider_descriptor_t
   gchar *homepage;
   gchar *icon;
 
+  /** NULL terminated list of item types a search can produce, NULL
+      if any type */
+  gchar **types;
+
+  /** TRUE if search honours the offset, a next page of the search
+      result is only linked for a paged search */
+  gboolean paged;
+
   void (*destroy)(struct cio_provider_descriptor_t *self);
 
   /*
    * api
    */
 
-  /** get a list of items for specified path */
+  /** get a list of items for specified path, NULL if path has no
+      items or with err set if the provider failed */
   JsonNode *(*items)(struct cio_provider_descriptor_t *self,
-		      const char *path, gsize offset, gssize limit);
+		      const char *path, gsize offset, gssize limit,
+		      GError **err);
+
+  /** get a list of items for specified path serialized as json to
+      data by the provider itself and the members of each item in
+      items, FALSE if path has no items or with err set if the
+      provider failed, NULL if the provider has no serializer */
+  gboolean (*items_data)(struct cio_provider_descriptor_t *self,
+			 const char *path, gsize offset, gssize limit,
+			 gchar **data, GPtrArray **items, GError **err);
 
-  void (*search)(struct cio_provider_descriptor_t *self,
-		 gchar *keywords,
-		 cio_provider_search_on_item_callback_t callback,
-		 gpointer user_data);
+  /** search for a page of items starting at offset of requested
+      types or any type if NULL, returns FALSE if the search failed */
+  gboolean (*search)(struct cio_provider_descriptor_t *self,
+		     gchar *keywords, gchar **types, gsize offset, gssize limit,
+		     cio_provider_search_on_item_callback_t callback,
+		     gpointer user_data);
+
+  /** check if the items of path may be cached, NULL if all paths
+      are cacheable */
+  gboolean (*cacheable)(struct cio_provider_descriptor_t *self, const char *path);
 
   void *opaque;
   struct cio_service_t *service;
+
+  /* latency of items and search requests */
+  cio_provider_stats_t stats;
+
+  /* latency of upstream http requests */
+  cio_provider_stats_t http;
+
+  /* bytes allocated by the script states of a plugin and the peak of
+     the sum, updated when a state is returned to the plugin */
+  gsize memory;
+  gsize memory_peak;
+
+  /* serialized item responses by path, offset and limit */
+  GHashTable *responses;
+
+  /* worker threads producing items and the lock of http stats and
+     memory usage recorded from them */
+  GThreadPool *pool;
+  GMutex lock;
+
+  /* generation of the items requests of each client by client host,
+     incremented by each request and cancels the prefetches of the
+     listings the client has left, used under lock */
+  GHashTable *sessions;
+
+  /* listings queued for prefetch, limited by the prefetch setting */
+  guint prefetches;
+
+  /* held by the providers of service and each request in flight, a
+     replaced provider is destroyed when its last request is done */
+  gint ref;
 } cio_provider_descriptor_t;
 
 cio_provider_descriptor_t *cio_provider_instance(struct cio_service_t *service,
@@ -75,6 +180,35 @@ cio_provider_descriptor_t *cio_provider_instance(struct cio_service_t *service,
 
 void cio_provider_destroy(struct cio_provider_descriptor_t *provider);
 
+/** take a reference of provider, released with cio_provider_unref()
+    on the main loop which destroys provider when no reference is
+    left */
+struct cio_provider_descriptor_t *cio_provider_ref(struct cio_provider_descriptor_t *provider);
+void cio_provider_unref(struct cio_provider_descriptor_t *provider);
+
+/** get the members of item used by the index, suggestions and
+    prefetch, NULL if item is not an object */
+cio_provider_item_t *cio_provider_item_new(JsonNode *item);
+void cio_provider_item_free(cio_provider_item_t *item);
+
+/** record latency and outcome of a request, returns TRUE if the
+    circuit breaker was opened */
+gboolean cio_provider_stats_record(cio_provider_stats_t *stats, gint64 usec, gboolean success);
+
+/** latency percentile in usec, -1 if there are too few samples */
+gint64 cio_provider_stats_percentile(cio_provider_stats_t *stats, guint percentile);
+
+/** check the circuit breaker if a request is allowed */
+gboolean cio_provider_stats_allow(cio_provider_stats_t *stats);
+
+/** queue a search of provider on its worker threads, done is called
+    on the main loop with the items found */
+void cio_provider_search_queue(struct cio_provider_descriptor_t *provider,
+			       const gchar *keywords, gchar **types,
+			       gsize offset, gssize limit,
+			       cio_provider_search_done_callback_t done,
+			       gpointer user_data);
+
 void cio_provider_request_handler(SoupServer *server, SoupMessage *msg, const char *path,
 				  GHashTable *query, SoupClientContext *client, gpointer user_data);
 #endif /* _provider_h */
@@ -27,7 +27,8 @@
 
 static JsonNode *
 _movie_library_items(cio_provider_descriptor_t *provider,
-		     const char *path, gsize offset, gssize limit)
+		     const char *path, gsize offset, gssize limit,
+		     GError **error)
 {
   GDir *dir;
   GError *err;
@@ -50,6 +51,12 @@ _movie_library_items(cio_provider_descriptor_t *provider,
   {
     g_log(DOMAIN, G_LOG_LEVEL_WARNING,
 	  "Failed to read directory: %s", err->message);
+
+    /* a missing directory has no items */
+    if (!g_error_matches(err, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      g_propagate_error(error, err);
+    else
+      g_clear_error(&err);
     return NULL;
   }
 
@@ -83,32 +90,48 @@ _movie_library_destroy(cio_provider_descriptor_t *self)
   g_free(self);
 }
 
-static void
+static gboolean
 _movie_library_search(cio_provider_descriptor_t *provider,
-		      gchar *keywords,
+		      gchar *keywords, gchar **types, gsize offset, gssize limit,
 		      cio_provider_search_on_item_callback_t callback,
 		      gpointer user_data)
 {
+  int res;
+  gsize i;
   JsonNode *item;
+  static const gchar *test_items[] = {
+    "/provider/movies/item/91728277",
+    "/provider/movies/item/82927711",
+  };
 
   item = NULL;
 
   /* TODO: Search for keywords and push each item back through
      callback, use a thread for the searcher */
 
-  /* create two test item_ref and push to caller */
-  item = json_node_alloc();
-  item = json_node_init_string(item, "/provider/movies/item/91728277");
-  callback(provider, item, user_data);
+  /* push the requested page of test item_refs to caller */
+  for (i = offset; i < G_N_ELEMENTS(test_items); i++)
+  {
+    if (limit >= 0 && i >= offset + limit)
+      break;
+
+    item = json_node_alloc();
+    item = json_node_init_string(item, test_items[i]);
+    res = callback(provider, item, user_data);
+    json_node_free(item);
 
-  item = json_node_alloc();
-  item = json_node_init_string(item, "/provider/movies/item/82927711");
-  callback(provider, item, user_data);
+    if (res != 0)
+      break;
+  }
 
   /* end the search by pushing a NULL item */
   callback(provider, NULL, user_data);
+  return TRUE;
 }
 
+static gchar *
+_movie_library_types[] = { "movie", NULL };
+
 static cio_provider_descriptor_t
 _movie_library_descriptor =
 {
@@ -120,6 +143,8 @@ _movie_library_descriptor =
   .version = {0,0,1},
   .homepage = "http://github.com/hean01/castio",
   .icon = "http://raw.githubusercontent.com/hean01/castio/master/images/movie_library_provider.png",
+  .types = _movie_library_types,
+  .paged = TRUE,
 
   .destroy = _movie_library_destroy,
 
@@ -18,66 +18,80 @@
  *
  */
 
-#include <archive.h>
-#include <archive_entry.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "config.h"
 #include "js/js.h"
 #include "plugin.h"
 #include "service.h"
 #include "blobcache.h"
+#include "settings.h"
+#include "router.h"
+#include "bundle.h"
 
 #define DOMAIN "plugin"
 
-static inline gboolean
-_provider_plugin_match(const char *l, const char *r, const char **arg)
-{
-  const gchar *pl, *pr;
+/* maximum size in bytes of the http caches of a plugin, divided
+   among the instances of its 'workers' setting */
+#define PLUGIN_HTTP_CACHE_SIZE (32L*1024L*1024L)
 
-  g_assert(l != NULL);
-  g_assert(r != NULL);
+/* number of http cache directories of a plugin, enough for the
+   instances of a plugin and the one it replaces while reloaded */
+#define PLUGIN_HTTP_CACHES 64
 
-  pl = l;
-  pr = r;
+/* maximum number of instances of a plugin */
+#define PLUGIN_MAX_INSTANCES 16
 
-  while (*pl)
-  {
-    if (*pl == '*')
-    {
-      *arg = pr;
-      return TRUE;
-    }
+/* seconds an instance is kept unused before it is destroyed */
+#define PLUGIN_INSTANCE_IDLE 60
 
-    if (*pl != *pr)
-      break;
+/* size of the header holding the size of a block allocated by a
+   javascript state, keeps the returned memory aligned */
+#define PLUGIN_ALLOC_HEADER 16
 
-    pl++;
-    pr++;
-  }
+/* seconds between checks for an idle plugin to evict */
+#define PLUGIN_EVICT_INTERVAL 30
 
-  if (*pl == '\0' && *pr == '\0')
-    return TRUE;
+/* milliseconds between checks of the watchdog for overdue calls */
+#define PLUGIN_WATCHDOG_INTERVAL 500
 
-  return FALSE;
-}
+/* number of overdue calls before a plugin is disabled */
+#define PLUGIN_MAX_OFFENSES 3
 
-static const gchar *
-_provider_plugin_match_handler(js_provider_t *js, const char *path, const gchar **arg)
+/* instances of a plugin script, each has its own javascript state
+   and a request checks out an idle instance or creates a new one,
+   no instance exists until the plugin is first used */
+typedef struct _provider_plugin_t
 {
-  GList *it;
+  gchar *script;
 
-  it = g_list_first(js->paths);
-  *arg = NULL;
-  while(it)
-  {
-    if (_provider_plugin_match(it->data, path, arg) == TRUE)
-      return it->data;
+  /* paths and uncached paths registered by the script when loaded,
+     same for all instances and used on the main loop */
+  struct cio_router_t *router;
+  GList *uncached;
 
-    it = g_list_next(it);
-  }
+  guint evict;
 
-  return NULL;
-}
+  /* calls which exceeded their time budget since last disabled */
+  gint offenses;
+
+  GMutex lock;
+  GCond returned;
+  GQueue *idle;
+  guint instances;
+} _provider_plugin_t;
+
+/* instances performing a call with a time budget, watched by the
+   watchdog thread which is shared by all plugins */
+static GMutex g_watchdog_lock;
+static GList *g_watchdog_calls;
+
+/* http cache directories in use by live instances by plugin id, a
+   bit for each directory so no two instances share one, also when a
+   plugin is loaded or replaced while its instances are running */
+static GMutex g_cache_lock;
+static GHashTable *g_cache_slots;
 
 static cio_provider_descriptor_t *
 _provider_plugin_manifest_parse(gchar *manifest, gssize len, gchar **icon, gchar **plugin)
@@ -161,19 +175,345 @@ _provider_plugin_manifest_parse(gchar *manifest, gssize len, gchar **icon, gchar
   return provider;
 }
 
-static gboolean
-_provider_plugin_init(cio_provider_descriptor_t *provider, gchar *content, gssize len)
+/** allocator of a javascript state accounting the bytes in use, an
+    allocation beyond the limit of the instance fails which is raised
+    as an out of memory error in the script */
+static void *
+_provider_plugin_alloc(void *actx, void *ptr, int size)
 {
+  gsize old;
+  guchar *block;
   js_provider_t *js;
+
+  js = (js_provider_t *)actx;
+  block = NULL;
+  old = 0;
+
+  if (ptr)
+  {
+    block = (guchar *)ptr - PLUGIN_ALLOC_HEADER;
+    old = *(gsize *)block;
+  }
+
+  if (size == 0)
+  {
+    js->memory -= old;
+    free(block);
+    return NULL;
+  }
+
+  /* interrupt an overdue call */
+  if (g_atomic_int_get(&js->expired))
+    return NULL;
+
+  if (js->memory_limit && js->memory - old + size > js->memory_limit)
+    return NULL;
+
+  block = realloc(block, size + PLUGIN_ALLOC_HEADER);
+  if (block == NULL)
+    return NULL;
+
+  *(gsize *)block = size;
+  js->memory = js->memory - old + size;
+  js->memory_peak = MAX(js->memory_peak, js->memory);
+
+  return block + PLUGIN_ALLOC_HEADER;
+}
+
+/** get the 'memory_limit' setting of provider in bytes */
+static gsize
+_provider_plugin_memory_limit(cio_provider_descriptor_t *provider)
+{
+  gint limit;
+
+  limit = cio_settings_get_int_value(provider->service->settings,
+				     provider->id, "memory_limit", NULL);
+  return limit > 0 ? (gsize)limit * 1024 * 1024 : 0;
+}
+
+/** add the change of memory used by instance to provider usage, a
+    retired instance removes its usage */
+static void
+_provider_plugin_account(cio_provider_descriptor_t *provider, js_provider_t *js,
+			 gboolean retire)
+{
+  g_mutex_lock(&provider->lock);
+
+  provider->memory -= js->memory_reported;
+  js->memory_reported = retire ? 0 : js->memory;
+  provider->memory += js->memory_reported;
+  provider->memory_peak = MAX(provider->memory_peak, provider->memory);
+
+  g_mutex_unlock(&provider->lock);
+}
+
+/* an overdue call reported by the watchdog, copied out of the
+   provider which may be destroyed once the call is interrupted */
+typedef struct _provider_plugin_offense_t
+{
+  gchar *id;
+  struct cio_settings_t *settings;
+  gboolean disable;
+} _provider_plugin_offense_t;
+
+/** count an overdue call of plugin, the plugin is disabled when too
+    many calls have exceeded their time budget */
+static _provider_plugin_offense_t *
+_provider_plugin_offense_new(cio_provider_descriptor_t *provider)
+{
+  _provider_plugin_t *plugin;
+  _provider_plugin_offense_t *offense;
+
+  plugin = provider->opaque;
+
+  offense = g_new0(_provider_plugin_offense_t, 1);
+  offense->id = g_strdup(provider->id);
+  offense->settings = provider->service->settings;
+
+  if (g_atomic_int_add(&plugin->offenses, 1) + 1 >= PLUGIN_MAX_OFFENSES)
+  {
+    g_atomic_int_set(&plugin->offenses, 0);
+    offense->disable = TRUE;
+  }
+
+  return offense;
+}
+
+/** report an overdue call and disable its plugin, the disabled state
+    is saved to be kept after a restart */
+static void
+_provider_plugin_offense_report(_provider_plugin_offense_t *offense)
+{
+  GError *err;
+  JsonNode *node;
+  JsonObject *object, *setting;
+
+  err = NULL;
+
+  g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	"[%s] Call exceeded its time budget, interrupting it.", offense->id);
+
+  if (offense->disable)
+  {
+    setting = json_object_new();
+    json_object_set_boolean_member(setting, "value", FALSE);
+    object = json_object_new();
+    json_object_set_object_member(object, "enabled", setting);
+    node = json_node_init_object(json_node_alloc(), object);
+    json_object_unref(object);
+
+    if (cio_settings_update_section(offense->settings, offense->id, node))
+    {
+      g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	    "[%s] Plugin disabled, %d calls exceeded their time budget.",
+	    offense->id, PLUGIN_MAX_OFFENSES);
+
+      if (!cio_settings_save(offense->settings, &err))
+      {
+	g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	      "[%s] Failed to save disabled plugin: %s", offense->id, err->message);
+	g_clear_error(&err);
+      }
+    }
+
+    json_node_free(node);
+  }
+
+  g_free(offense->id);
+  g_free(offense);
+}
+
+/** flag calls past their deadline, an overdue call is interrupted by
+    its next allocation or http request since the interpreter can not
+    be preempted */
+static gpointer
+_provider_plugin_watchdog(gpointer data)
+{
+  gint64 now;
+  GList *link;
+  GSList *offenses;
+  js_provider_t *js;
+
+  while (TRUE)
+  {
+    g_usleep(PLUGIN_WATCHDOG_INTERVAL * 1000);
+    now = g_get_monotonic_time();
+    offenses = NULL;
+
+    g_mutex_lock(&g_watchdog_lock);
+    for (link = g_watchdog_calls; link; link = g_list_next(link))
+    {
+      js = link->data;
+      if (now < js->deadline || g_atomic_int_get(&js->expired))
+	continue;
+
+      g_atomic_int_set(&js->expired, 1);
+      offenses = g_slist_prepend(offenses, _provider_plugin_offense_new(js->provider));
+    }
+    g_mutex_unlock(&g_watchdog_lock);
+
+    /* settings are written without blocking calls starting or ending */
+    g_slist_free_full(offenses, (GDestroyNotify)_provider_plugin_offense_report);
+  }
+
+  return NULL;
+}
+
+static gpointer
+_provider_plugin_watchdog_start(gpointer data)
+{
+  return g_thread_new("watchdog", _provider_plugin_watchdog, NULL);
+}
+
+/** call the function on the stack of instance within the
+    'time_budget' setting of provider */
+static int
+_provider_plugin_pcall(js_provider_t *js, int nargs)
+{
+  int res;
+  gint budget;
+  static GOnce watchdog = G_ONCE_INIT;
+
+  budget = cio_settings_get_int_value(js->provider->service->settings,
+				      js->provider->id, "time_budget", NULL);
+  if (budget <= 0)
+    return js_pcall(js->state, nargs);
+
+  g_once(&watchdog, _provider_plugin_watchdog_start, NULL);
+
+  g_mutex_lock(&g_watchdog_lock);
+  js->deadline = g_get_monotonic_time() + (gint64)budget * G_USEC_PER_SEC;
+  g_watchdog_calls = g_list_prepend(g_watchdog_calls, js);
+  g_mutex_unlock(&g_watchdog_lock);
+
+  res = js_pcall(js->state, nargs);
+
+  g_mutex_lock(&g_watchdog_lock);
+  g_watchdog_calls = g_list_remove(g_watchdog_calls, js);
+  js->deadline = 0;
+  g_mutex_unlock(&g_watchdog_lock);
+
+  /* an interrupted call fails even if the script caught the error */
+  if (g_atomic_int_get(&js->expired) && res == 0)
+  {
+    js_pop(js->state, 1);
+    js_pushstring(js->state, "Call exceeded its time budget");
+    res = 1;
+  }
+
+  g_atomic_int_set(&js->expired, 0);
+  return res;
+}
+
+/** reserve the first http cache directory of plugin id not used by
+    a live instance, -1 if all are used */
+static gint
+_provider_plugin_cache_reserve(const gchar *id)
+{
+  gint slot;
+  guint64 *slots;
+
+  g_mutex_lock(&g_cache_lock);
+
+  if (g_cache_slots == NULL)
+    g_cache_slots = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+  slots = g_hash_table_lookup(g_cache_slots, id);
+  if (slots == NULL)
+  {
+    slots = g_new0(guint64, 1);
+    g_hash_table_insert(g_cache_slots, g_strdup(id), slots);
+  }
+
+  for (slot = 0; slot < PLUGIN_HTTP_CACHES && (*slots & ((guint64)1 << slot)); slot++);
+
+  if (slot < PLUGIN_HTTP_CACHES)
+    *slots |= (guint64)1 << slot;
+  else
+    slot = -1;
+
+  g_mutex_unlock(&g_cache_lock);
+  return slot;
+}
+
+static void
+_provider_plugin_cache_release(const gchar *id, guint slot)
+{
+  guint64 *slots;
+
+  g_mutex_lock(&g_cache_lock);
+  slots = g_hash_table_lookup(g_cache_slots, id);
+  if (slots)
+    *slots &= ~((guint64)1 << slot);
+  g_mutex_unlock(&g_cache_lock);
+}
+
+static void
+_provider_plugin_instance_free(js_provider_t *js)
+{
+  js_freestate(js->state);
+
+  /* the directory is released when the cache is written */
+  soup_cache_dump(js->cache);
+  g_object_unref(js->cache);
+  _provider_plugin_cache_release(js->provider->id, js->slot);
+
+  if (js->router)
+    cio_router_destroy(js->router);
+  g_list_free_full(js->uncached, g_free);
+  g_strfreev(js->types);
+  g_free(js);
+}
+
+/** create an instance by running the plugin script in a new state
+    with an http cache directory of its own */
+static js_provider_t *
+_provider_plugin_instance_new(cio_provider_descriptor_t *provider,
+			      const gchar *content)
+{
+  gint slot, workers;
+  js_provider_t *js;
+  gchar slot_dir[16];
+  gchar *cache_dir;
   const gchar *message;
 
-  provider->opaque = NULL;
+  slot = _provider_plugin_cache_reserve(provider->id);
+  if (slot < 0)
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	  "[%s] No http cache left for another instance.", provider->id);
+    return NULL;
+  }
 
   /* initialize JS context for plugin */
   js = g_malloc(sizeof(js_provider_t));
   memset(js, 0, sizeof(js_provider_t));
   js->provider = provider;
-  js->state = js_newstate(NULL, NULL, JS_STRICT);
+  js->slot = slot;
+  js->router = cio_router_new(g_free);
+  js->state = js_newstate(_provider_plugin_alloc, js, JS_STRICT);
+  if (js->state == NULL)
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	  "[%s] Failed to create javascript state.", provider->id);
+    _provider_plugin_cache_release(provider->id, slot);
+    cio_router_destroy(js->router);
+    g_free(js);
+    return NULL;
+  }
+
+  /* http cache of plugin instance, its share of the plugin size */
+  workers = cio_settings_get_int_value(provider->service->settings,
+				       provider->id, "workers", NULL);
+  workers = CLAMP(workers, 1, PLUGIN_MAX_INSTANCES);
+
+  g_snprintf(slot_dir, sizeof(slot_dir), "%d", slot);
+  cache_dir = g_build_filename(CASTIO_INSTALL_PREFIX"/var/cache/castio/http",
+			       provider->id, slot_dir, NULL);
+  js->cache = soup_cache_new(cache_dir, SOUP_CACHE_SINGLE_USER);
+  soup_cache_set_max_size(js->cache, PLUGIN_HTTP_CACHE_SIZE / workers);
+  soup_cache_load(js->cache);
+  g_free(cache_dir);
 
   /* service object added to global scope */
   js_service_init(js->state, js);
@@ -196,6 +536,9 @@ _provider_plugin_init(cio_provider_descriptor_t *provider, gchar *content, gssiz
   js_setglobal(js->state, "http");
 
 
+  /* the script runs within the memory limit */
+  js->memory_limit = _provider_plugin_memory_limit(provider);
+
   /* read and parse the javascript */
   if (js_ploadstring(js->state, "script.js", content) != 0)
   {
@@ -204,34 +547,235 @@ _provider_plugin_init(cio_provider_descriptor_t *provider, gchar *content, gssiz
 	  "[%s] %s",
 	  provider->id, message);
 
-    return FALSE;
+    _provider_plugin_instance_free(js);
+    return NULL;
   }
 
   js_newobject(js->state);
-  if (js_pcall(js->state, 0) != 0)
+  if (_provider_plugin_pcall(js, 0) != 0)
   {
     message = js_tostring(js->state, -1);
     g_log(DOMAIN, G_LOG_LEVEL_WARNING,
 	  "[%s] Failed to initialize: %s",
 	  provider->id, message);
-    return FALSE;
+
+    _provider_plugin_instance_free(js);
+    return NULL;
+  }
+  js_pop(js->state, 1);
+
+  return js;
+}
+
+/** destroy all instances of an idle plugin when none has been used
+    for 'idle_timeout' seconds, the script is run again on next use */
+static gboolean
+_provider_plugin_evict(gpointer user_data)
+{
+  gint64 timeout;
+  GList *expired, *link;
+  js_provider_t *js;
+  cio_provider_descriptor_t *provider;
+  _provider_plugin_t *plugin;
+
+  provider = user_data;
+  plugin = provider->opaque;
+  expired = NULL;
+
+  timeout = cio_settings_get_int_value(provider->service->settings,
+				       provider->id, "idle_timeout", NULL);
+  if (timeout <= 0)
+    return TRUE;
+
+  g_mutex_lock(&plugin->lock);
+
+  /* most recently used instance is at the head */
+  js = g_queue_peek_head(plugin->idle);
+  if (js && plugin->instances == g_queue_get_length(plugin->idle)
+      && g_get_monotonic_time() - js->used >= timeout * G_USEC_PER_SEC)
+  {
+    expired = plugin->idle->head;
+    g_queue_init(plugin->idle);
+    plugin->instances = 0;
   }
 
-  provider->opaque = js;
+  g_mutex_unlock(&plugin->lock);
+
+  if (expired)
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_INFO,
+	  "[%s] Evicting %u idle instances of plugin.",
+	  provider->id, g_list_length(expired));
+    for (link = expired; link; link = g_list_next(link))
+      _provider_plugin_account(provider, link->data, TRUE);
+    g_list_free_full(expired, (GDestroyNotify)_provider_plugin_instance_free);
+  }
 
   return TRUE;
 }
 
+static gboolean
+_provider_plugin_init(cio_provider_descriptor_t *provider, gchar *content, gssize len)
+{
+  js_provider_t *js;
+  _provider_plugin_t *plugin;
+
+  /* run the script once on the loader thread to validate it and get
+     its paths and the item types of its search before provider is
+     published */
+  js = _provider_plugin_instance_new(provider, content);
+  if (js == NULL)
+    return FALSE;
+
+  plugin = g_new0(_provider_plugin_t, 1);
+  plugin->router = js->router;
+  plugin->uncached = js->uncached;
+  js->router = NULL;
+  js->uncached = NULL;
+
+  provider->types = g_strdupv(js->types);
+  provider->paged = js->paged;
+  _provider_plugin_instance_free(js);
+
+  plugin->script = g_strndup(content, len);
+  g_mutex_init(&plugin->lock);
+  g_cond_init(&plugin->returned);
+  plugin->idle = g_queue_new();
+
+  provider->opaque = plugin;
+
+  /* instances are created on first use */
+  plugin->evict = g_timeout_add_seconds(PLUGIN_EVICT_INTERVAL,
+					_provider_plugin_evict, provider);
+
+  return TRUE;
+}
+
+/** check out an idle instance of plugin, a new instance is created if
+    all are busy and fewer than the 'workers' setting of provider
+    exists, otherwise wait for an instance to be returned */
+static js_provider_t *
+_provider_plugin_checkout(cio_provider_descriptor_t *provider)
+{
+  guint instance;
+  gint max;
+  gsize limit;
+  js_provider_t *js;
+  _provider_plugin_t *plugin;
+
+  plugin = provider->opaque;
+
+  max = cio_settings_get_int_value(provider->service->settings,
+				   provider->id, "workers", NULL);
+  max = CLAMP(max, 1, PLUGIN_MAX_INSTANCES);
+  limit = _provider_plugin_memory_limit(provider);
+
+  g_mutex_lock(&plugin->lock);
+  while ((js = g_queue_pop_head(plugin->idle)) == NULL)
+  {
+    if (plugin->instances < (guint)max)
+    {
+      /* count the instance and create it without holding lock */
+      instance = ++plugin->instances;
+      g_mutex_unlock(&plugin->lock);
+
+      g_log(DOMAIN, G_LOG_LEVEL_INFO,
+	    "[%s] Creating instance %u of plugin.", provider->id, instance);
+
+      js = _provider_plugin_instance_new(provider, plugin->script);
+
+      g_mutex_lock(&plugin->lock);
+      if (js)
+      {
+	g_mutex_unlock(&plugin->lock);
+	js->memory_limit = limit;
+	return js;
+      }
+
+      plugin->instances--;
+      g_cond_signal(&plugin->returned);
+      g_mutex_unlock(&plugin->lock);
+      return NULL;
+    }
+
+    g_cond_wait(&plugin->returned, &plugin->lock);
+  }
+  g_mutex_unlock(&plugin->lock);
+
+  js->memory_limit = limit;
+  return js;
+}
+
+/** return an instance to the idle instances, instances unused for a
+    while are destroyed */
+static void
+_provider_plugin_checkin(cio_provider_descriptor_t *provider, js_provider_t *js)
+{
+  gint64 now;
+  GList *link, *prev;
+  GSList *expired, *item;
+  js_provider_t *instance;
+  _provider_plugin_t *plugin;
+
+  plugin = provider->opaque;
+  expired = NULL;
+
+  /* collect garbage of a state using more than half its limit */
+  if (js->memory_limit && js->memory > js->memory_limit / 2)
+    js_gc(js->state, 0);
+
+  _provider_plugin_account(provider, js, FALSE);
+
+  now = g_get_monotonic_time();
+  g_mutex_lock(&plugin->lock);
+
+  js->used = now;
+  g_queue_push_head(plugin->idle, js);
+
+  /* least recently used instances are at the tail */
+  for (link = g_queue_peek_tail_link(plugin->idle); link; link = prev)
+  {
+    prev = link->prev;
+    instance = link->data;
+    if (now - instance->used < PLUGIN_INSTANCE_IDLE * G_USEC_PER_SEC)
+      continue;
+
+    g_queue_delete_link(plugin->idle, link);
+    plugin->instances--;
+    expired = g_slist_prepend(expired, instance);
+  }
+
+  g_cond_signal(&plugin->returned);
+  g_mutex_unlock(&plugin->lock);
+
+  if (expired)
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_INFO,
+	  "[%s] Destroying %u unused instances of plugin.",
+	  provider->id, g_slist_length(expired));
+    for (item = expired; item; item = g_slist_next(item))
+      _provider_plugin_account(provider, item->data, TRUE);
+    g_slist_free_full(expired, (GDestroyNotify)_provider_plugin_instance_free);
+  }
+}
+
 static void
 _provider_plugin_destroy(struct cio_provider_descriptor_t *self)
 {
-  js_provider_t *js;
+  _provider_plugin_t *plugin;
 
-  js = self->opaque;
+  plugin = self->opaque;
 
-  js_freestate(js->state);
-  g_list_free_full(js->paths, g_free);
-  g_free(js);
+  g_source_remove(plugin->evict);
+  g_queue_free_full(plugin->idle, (GDestroyNotify)_provider_plugin_instance_free);
+  cio_router_destroy(plugin->router);
+  g_list_free_full(plugin->uncached, g_free);
+  g_mutex_clear(&plugin->lock);
+  g_cond_clear(&plugin->returned);
+  g_free(plugin->script);
+  g_free(plugin);
+
+  g_strfreev(self->types);
 
   g_free(self->id);
   g_free(self->name);
@@ -242,13 +786,14 @@ _provider_plugin_destroy(struct cio_provider_descriptor_t *self)
   g_free(self);
 }
 
-static void
+static gboolean
 _provider_plugin_search_proxy(struct cio_provider_descriptor_t *self,
-			      gchar *keywords,
+			      gchar *keywords, gchar **types, gsize offset, gssize limit,
 			      cio_provider_search_on_item_callback_t callback,
 			      gpointer user_data)
 {
   int idx;
+  gboolean res;
   GList *l, *it;
   const gchar *message;
   char **kw, **pkw;
@@ -256,8 +801,15 @@ _provider_plugin_search_proxy(struct cio_provider_descriptor_t *self,
   JsonNode *node;
   JsonArray *array;
 
-  js = self->opaque;
   kw = NULL;
+  res = FALSE;
+
+  js = _provider_plugin_checkout(self);
+  if (js == NULL)
+  {
+    callback(self, NULL, user_data);
+    return FALSE;
+  }
 
   /* push function and this object to stack  */
   js_getregistry(js->state, "plugin.search");
@@ -265,6 +817,7 @@ _provider_plugin_search_proxy(struct cio_provider_descriptor_t *self,
   {
     g_log(DOMAIN, G_LOG_LEVEL_INFO,
 	  "[%s.search] Plugin do not support search.", self->id);
+    js_pop(js->state, 1);
     goto bail_out;
   }
 
@@ -282,14 +835,33 @@ _provider_plugin_search_proxy(struct cio_provider_descriptor_t *self,
   js_setlength(js->state, -1, idx);
 
   /* push limit number to stack */
-  js_pushnumber(js->state, 10);
+  js_pushnumber(js->state, limit);
+
+  /* push options object with offset to stack */
+  js_newobject(js->state);
+  js_pushnumber(js->state, offset);
+  js_setproperty(js->state, -2, "offset");
+
+  /* add requested item types to options */
+  if (types)
+  {
+    idx = 0;
+    js_newarray(js->state);
+    for (pkw = types; *pkw != NULL; pkw++) {
+      js_pushstring(js->state, *pkw);
+      js_setindex(js->state, -2, idx++);
+    }
+    js_setlength(js->state, -1, idx);
+    js_setproperty(js->state, -2, "types");
+  }
 
   /* perform the function call */
-  if (js_pcall(js->state, 2) != 0)
+  if (_provider_plugin_pcall(js, 3) != 0)
   {
     message =  js_tostring(js->state, -1);
     g_log(DOMAIN, G_LOG_LEVEL_CRITICAL,
 	  "[%s.search] %s", self->id, message);
+    js_pop(js->state, 1);
     goto bail_out;
   }
 
@@ -298,10 +870,14 @@ _provider_plugin_search_proxy(struct cio_provider_descriptor_t *self,
   {
     g_log(DOMAIN, G_LOG_LEVEL_CRITICAL,
 	  "[%s.search] result is not an array.", self->id);
+    js_pop(js->state, 1);
     goto bail_out;
   }
 
   node = js_util_tojsonnode(js->state, -1);
+  js_pop(js->state, 1);
+  res = TRUE;
+
   array = json_node_get_array(node);
 
   l = it = json_array_get_elements(array);
@@ -309,7 +885,7 @@ _provider_plugin_search_proxy(struct cio_provider_descriptor_t *self,
   {
     if (callback(js->provider, it->data, user_data) != 0)
     {
-      g_log(DOMAIN, G_LOG_LEVEL_ERROR,
+      g_log(DOMAIN, G_LOG_LEVEL_INFO,
 	    "[%s.search] aborted.", self->id);
       break;
     }
@@ -319,26 +895,61 @@ _provider_plugin_search_proxy(struct cio_provider_descriptor_t *self,
   if (l)
     g_list_free(l);
 
+  json_node_free(node);
+
 bail_out:
+  _provider_plugin_checkin(self, js);
+
   /* end search for provider */
-  callback(js->provider, NULL, user_data);
+  callback(self, NULL, user_data);
   if (kw)
     g_strfreev(kw);
+
+  return res;
 }
 
 
-static JsonNode *
-_provider_plugin_items_proxy(struct cio_provider_descriptor_t *self, const gchar *path,
-			     gsize offset, gssize limit)
+static gboolean
+_provider_plugin_cacheable(struct cio_provider_descriptor_t *self, const gchar *path)
 {
   gchar *fp;
-  const gchar *arg;
+  const gchar *rest;
   const gchar *handler;
-  JsonNode *node;
+  GHashTable *params;
+  _provider_plugin_t *plugin;
+
+  plugin = self->opaque;
+
+  fp = g_strdup_printf("/%s", path);
+  handler = cio_router_lookup(plugin->router, fp, &params, &rest);
+  if (params)
+    g_hash_table_destroy(params);
+  g_free(fp);
+
+  return (handler == NULL
+	  || g_list_find_custom(plugin->uncached, handler, (GCompareFunc)strcmp) == NULL);
+}
+
+/** call handler of path leaving its result on the stack of the
+    returned instance, NULL if path has no handler or with err set if
+    the call failed or was interrupted */
+static js_provider_t *
+_provider_plugin_call(struct cio_provider_descriptor_t *self, const gchar *path,
+		      gsize offset, gssize limit, GError **err)
+{
+  gchar *fp;
+  gint nargs;
+  const gchar *rest;
+  const gchar *handler;
+  GHashTable *params;
+  GHashTableIter iter;
+  gpointer name, value;
   const gchar *message;
   js_provider_t *js;
+  _provider_plugin_t *plugin;
 
-  js = self->opaque;
+  plugin = self->opaque;
+  js = NULL;
 
   fp = g_malloc(strlen(path) + 2);
   fp[0] = 0;
@@ -347,14 +958,21 @@ _provider_plugin_items_proxy(struct cio_provider_descriptor_t *self, const gchar
   g_log(DOMAIN, G_LOG_LEVEL_DEBUG,
 	"[%s.items] Fetching items for uri '%s'", self->id, fp);
 
-  /* do have have a path match */
-  handler = _provider_plugin_match_handler(js, fp, &arg);
+  /* do have have a path match, all instances registers same paths */
+  handler = cio_router_lookup(plugin->router, fp, &params, &rest);
   if (handler == NULL)
   {
     g_log(DOMAIN, G_LOG_LEVEL_WARNING,
 	  "[%s.items] No matching handler for path '%s' found",
 	  self->id, fp);
-    return NULL;
+    goto bail_out;
+  }
+
+  js = _provider_plugin_checkout(self);
+  if (js == NULL)
+  {
+    g_set_error(err, CIO_PROVIDER_ERROR, 0, "No instance of plugin");
+    goto bail_out;
   }
 
   /* fetch function from registry to stack  */
@@ -363,8 +981,9 @@ _provider_plugin_items_proxy(struct cio_provider_descriptor_t *self, const gchar
   {
     g_log(DOMAIN, G_LOG_LEVEL_CRITICAL,
 	  "[%s.items] Handler function '%s' not found", self->id, handler);
+    g_set_error(err, CIO_PROVIDER_ERROR, 0, "Handler function '%s' not found", handler);
     js_pop(js->state, 1);
-    return NULL;
+    goto bail_out;
   }
 
   /* add this object to stack */
@@ -376,164 +995,333 @@ _provider_plugin_items_proxy(struct cio_provider_descriptor_t *self, const gchar
   /* push arg: limit to stack */
   js_newnumber(js->state, limit);
 
-  /* push arg: match arg to stack */
-  if (arg)
-    js_newstring(js->state, arg);
+  /* push arg: object of path parameters and wildcard or the string
+     matched by wildcard to stack */
+  nargs = 2;
+  if (params)
+  {
+    js_newobject(js->state);
+    g_hash_table_iter_init(&iter, params);
+    while (g_hash_table_iter_next(&iter, &name, &value))
+    {
+      js_pushstring(js->state, value);
+      js_setproperty(js->state, -2, name);
+    }
+
+    if (rest)
+    {
+      js_pushstring(js->state, rest);
+      js_setproperty(js->state, -2, "*");
+    }
+    nargs++;
+  }
+  else if (rest)
+  {
+    js_newstring(js->state, rest);
+    nargs++;
+  }
 
   /* perform the function call */
-  if (js_pcall(js->state, (arg != NULL) ? 3 : 2) != 0)
+  if (_provider_plugin_pcall(js, nargs) != 0)
   {
     message =  js_tostring(js->state, -1);
     g_log(DOMAIN, G_LOG_LEVEL_CRITICAL,
 	  "[%s.items] %s", self->id, message);
+    g_set_error(err, CIO_PROVIDER_ERROR, 0, "%s", message);
+    js_pop(js->state, 1);
+    goto bail_out;
   }
 
-  /* get result array */
+  goto finished;
+
+bail_out:
+  if (js)
+    _provider_plugin_checkin(self, js);
+  js = NULL;
+
+finished:
+  if (params)
+    g_hash_table_destroy(params);
+  g_free(fp);
+  return js;
+}
+
+/** get string member name of object on top of stack, NULL if it is
+    not a string */
+static gchar *
+_provider_plugin_string(js_State *state, const gchar *name)
+{
+  gchar *value;
+
+  value = NULL;
+  js_getproperty(state, -1, name);
+  if (js_isstring(state, -1))
+    value = g_strdup(js_tostring(state, -1));
+  js_pop(state, 1);
+
+  return value;
+}
+
+/** get the members of the item on top of stack used by the index,
+    suggestions and prefetch */
+static cio_provider_item_t *
+_provider_plugin_item(js_State *state)
+{
+  cio_provider_item_t *item;
+
+  item = g_new0(cio_provider_item_t, 1);
+  item->uri = _provider_plugin_string(state, "uri");
+  item->type = _provider_plugin_string(state, "type");
+
+  js_getproperty(state, -1, "metadata");
+  if (js_isobject(state, -1))
+  {
+    item->title = _provider_plugin_string(state, "title");
+    item->artist = _provider_plugin_string(state, "artist");
+    item->description = _provider_plugin_string(state, "description");
+  }
+  js_pop(state, 1);
+
+  return item;
+}
+
+/** serialize the result on top of stack, the members of each item of
+    an array are taken as the item is serialized */
+static gboolean
+_provider_plugin_serialize(js_State *state, GString *out, GPtrArray **items)
+{
+  gsize mark;
+  gboolean first;
+  unsigned int i, length;
+  cio_provider_item_t *item;
+
+  *items = NULL;
+  if (!js_isarray(state, -1))
+    return js_util_tojson(state, -1, out);
+
+  *items = g_ptr_array_new_with_free_func((GDestroyNotify)cio_provider_item_free);
+  g_string_append_c(out, '[');
+
+  first = TRUE;
+  length = js_getlength(state, -1);
+  for (i = 0; i < length; i++)
+  {
+    js_getindex(state, -1, i);
+
+    /* undefined and null elements are skipped */
+    mark = out->len;
+    if (!first)
+      g_string_append_c(out, ',');
+
+    if (!js_util_tojson(state, -1, out))
+      g_string_truncate(out, mark);
+    else
+    {
+      if (js_isobject(state, -1) && !js_isarray(state, -1))
+      {
+	item = _provider_plugin_item(state);
+	item->offset = first ? mark : mark + 1;
+	item->length = out->len - item->offset;
+	g_ptr_array_add(*items, item);
+      }
+      first = FALSE;
+    }
+
+    js_pop(state, 1);
+  }
+
+  g_string_append_c(out, ']');
+  return TRUE;
+}
+
+static JsonNode *
+_provider_plugin_items_proxy(struct cio_provider_descriptor_t *self, const gchar *path,
+			     gsize offset, gssize limit, GError **err)
+{
+  JsonNode *node;
+  js_provider_t *js;
+
+  js = _provider_plugin_call(self, path, offset, limit, err);
+  if (js == NULL)
+    return NULL;
+
   node = js_util_tojsonnode(js->state, -1);
+  js_pop(js->state, 1);
+  _provider_plugin_checkin(self, js);
+
   return node;
 }
 
+/** serialize the result of the handler directly from the stack
+    without a tree of the listing */
+static gboolean
+_provider_plugin_items_data_proxy(struct cio_provider_descriptor_t *self, const gchar *path,
+				  gsize offset, gssize limit, gchar **data,
+				  GPtrArray **items, GError **err)
+{
+  GString *out;
+  gboolean found;
+  js_provider_t *js;
+
+  *items = NULL;
+  js = _provider_plugin_call(self, path, offset, limit, err);
+  if (js == NULL)
+    return FALSE;
+
+  out = g_string_new(NULL);
+  found = _provider_plugin_serialize(js->state, out, items);
+  js_pop(js->state, 1);
+  _provider_plugin_checkin(self, js);
+
+  if (!found)
+  {
+    g_string_free(out, TRUE);
+    return FALSE;
+  }
+
+  *data = g_string_free(out, FALSE);
+  return TRUE;
+}
+
 cio_provider_descriptor_t *
 cio_provider_plugin_new(struct cio_service_t *service, const gchar *filename)
 {
-  int res;
-  gssize len;
+  gsize len;
+  GError *err;
   gchar *content;
   gchar *icon, *plugin;
-  struct archive *ar;
-  struct archive_entry *entry;
+  gchar uri[512];
+  JsonNode *value;
+  struct cio_bundle_t *bundle;
+  cio_blobcache_resource_header_t *hdr;
   cio_provider_descriptor_t *provider;
 
   g_assert(g_file_test(filename, G_FILE_TEST_EXISTS));
 
+  err = NULL;
   provider = NULL;
   plugin = icon = NULL;
 
   g_log(DOMAIN, G_LOG_LEVEL_INFO,
 	"Creating instance of: %s", filename);
 
-  /* read manifest and javascript of plugin */
-  ar = archive_read_new();
-  archive_read_set_format(ar, ARCHIVE_FORMAT_ZIP);
-  res = archive_read_open_filename(ar, filename, 10240);
-  if (res != ARCHIVE_OK)
+  /* map plugin archive and index its entries */
+  bundle = cio_bundle_open(filename, &err);
+  if (bundle == NULL)
   {
     g_log(DOMAIN, G_LOG_LEVEL_WARNING,
 	  "Failed to open plugin archive '%s' with reason: %s",
-	  filename, archive_error_string(ar));
+	  filename, err->message);
+    g_clear_error(&err);
     return NULL;
   }
 
-  while(1)
-  {
-    res = archive_read_next_header(ar, &entry);
-    if (res == ARCHIVE_EOF)
-      break;
-
-    if (res != ARCHIVE_OK)
-      break;
-
-    /* read and parse manifest */
-    if (strcmp(archive_entry_pathname(entry), "manifest") == 0)
-    {
-      len = archive_entry_size(entry);
-      content = g_malloc(len + 1);
-      memset(content, 0, len);
-      archive_read_data(ar, content, len);
-      provider = _provider_plugin_manifest_parse(content, len, &icon, &plugin);
-      g_free(content);
-      if (provider == NULL)
-	goto cleanup;
-    }
-  }
-
-  if (provider == NULL)
+  /* read and parse manifest */
+  content = cio_bundle_read(bundle, "manifest", &len, NULL);
+  if (content == NULL)
   {
     g_log(DOMAIN, G_LOG_LEVEL_WARNING,
 	  "Provider plugin '%s' does not contain a manifest.", filename);
-    return NULL;
+    goto cleanup;
   }
 
-  archive_read_close(ar);
-  archive_read_free(ar);
+  provider = _provider_plugin_manifest_parse(content, len, &icon, &plugin);
+  g_free(content);
+  if (provider == NULL)
+    goto cleanup;
 
   /* setup provider proxy functions */
   provider->service = service;
   provider->destroy = _provider_plugin_destroy;
   provider->search = _provider_plugin_search_proxy;
   provider->items = _provider_plugin_items_proxy;
+  provider->items_data = _provider_plugin_items_data_proxy;
+  provider->cacheable = _provider_plugin_cacheable;
 
-  /* Reopen to read plugin script and icon */
-  ar = archive_read_new();
-  archive_read_set_format(ar, ARCHIVE_FORMAT_ZIP);
-  res = archive_read_open_filename(ar, filename, 10240);
-  if (res != ARCHIVE_OK)
+  /* read the provider script */
+  content = plugin ? cio_bundle_read(bundle, plugin, &len, &err) : NULL;
+  if (content == NULL)
   {
     g_log(DOMAIN, G_LOG_LEVEL_WARNING,
-	  "Failed to open plugin archive '%s' with reason: %s",
-	  filename, archive_error_string(ar));
-    return NULL;
+	  "[%s] JavaScript plugin specified by manifest was not found: %s",
+	  provider->id, err ? err->message : "no plugin in manifest");
+    g_clear_error(&err);
+    goto cleanup;
   }
 
-  while (1)
+  /* add provider setting 'idle_timeout' if not exists */
+  if (!cio_settings_has_value(service->settings,
+			      provider->id, "idle_timeout"))
   {
-    res = archive_read_next_header(ar, &entry);
-    if (res == ARCHIVE_EOF)
-      break;
-
-    if (res != ARCHIVE_OK)
-      break;
+    value = json_node_init_int(json_node_alloc(), 600);
+    cio_settings_create_value(service->settings,
+			      provider->id, "idle_timeout",
+			      "Idle timeout",
+			      "Seconds the plugin is kept unused before its instances"
+			      " are destroyed, 0 keeps them.",
+			      value, NULL);
+    json_node_free(value);
+  }
 
-    /* read the provider script */
-    if (plugin && strcmp(archive_entry_pathname(entry), plugin) == 0)
-    {
-      len = archive_entry_size(entry);
-      content = g_malloc(len + 1);
-      memset(content, 0, len + 1);
-      archive_read_data(ar, content, len);
-      res = _provider_plugin_init(provider, content, len);
-      g_free(content);
-      if (res == FALSE)
-      {
-	g_log(DOMAIN, G_LOG_LEVEL_WARNING,
-	      "Provider '%s' failed to initialize.", filename);
-	goto cleanup;
-      }
-    }
+  /* add provider setting 'memory_limit' if not exists */
+  if (!cio_settings_has_value(service->settings,
+			      provider->id, "memory_limit"))
+  {
+    value = json_node_init_int(json_node_alloc(), 64);
+    cio_settings_create_value(service->settings,
+			      provider->id, "memory_limit",
+			      "Memory limit",
+			      "Megabytes each instance of the plugin may allocate,"
+			      " 0 disables the limit.",
+			      value, NULL);
+    json_node_free(value);
+  }
 
-    /* read the icon and store into blobcache with mimetype + size header */
-    if (plugin && strcmp(archive_entry_pathname(entry), icon) == 0)
-    {
-      char uri[512];
-      cio_blobcache_resource_header_t hdr;
-      memset(&hdr, 0, sizeof(hdr));
-      snprintf(hdr.mime, sizeof(hdr.mime), "image/png");
-      hdr.size = archive_entry_size(entry);
+  /* add provider setting 'time_budget' if not exists */
+  if (!cio_settings_has_value(service->settings,
+			      provider->id, "time_budget"))
+  {
+    value = json_node_init_int(json_node_alloc(), 60);
+    cio_settings_create_value(service->settings,
+			      provider->id, "time_budget",
+			      "Time budget",
+			      "Seconds a call of the plugin may run before it is interrupted,"
+			      " 0 disables the limit.",
+			      value, NULL);
+    json_node_free(value);
+  }
 
-      content = malloc(hdr.size + sizeof(hdr));
-      memset(content, 0, hdr.size + sizeof(hdr));
-      memcpy(content, &hdr, sizeof(hdr));
+  if (!_provider_plugin_init(provider, content, len))
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	  "Provider '%s' failed to initialize.", filename);
+    g_free(content);
+    goto cleanup;
+  }
+  g_free(content);
 
-      archive_read_data(ar, content + sizeof(hdr), hdr.size);
+  /* read the icon and store into blobcache with mimetype + size header */
+  if (icon && cio_bundle_contains(bundle, icon))
+  {
+    content = cio_bundle_read(bundle, icon, &len, NULL);
+    if (content)
+    {
+      hdr = g_malloc0(sizeof(cio_blobcache_resource_header_t) + len);
+      snprintf(hdr->mime, sizeof(hdr->mime), "image/png");
+      hdr->size = len;
+      memcpy(hdr + 1, content, len);
+      g_free(content);
 
-      // store icon to blob cache
       snprintf(uri, sizeof(uri), "%s://%s", provider->id, icon);
       provider->icon = g_strdup(uri);
-      cio_blobcache_store(service->blobcache, 0, g_str_hash(uri), content, hdr.size + sizeof(hdr));
+      cio_blobcache_store(service->blobcache, 0, g_str_hash(uri), hdr,
+			  sizeof(cio_blobcache_resource_header_t) + len);
+      g_free(hdr);
     }
-
   }
 
-  if (provider->opaque == NULL)
-  {
-    g_log(DOMAIN, G_LOG_LEVEL_WARNING,
-	  "[%s] JavaScript plugin specified by manifest was not found.", provider->id);
-  }
-
-
 cleanup:
-  archive_read_close(ar);
-  archive_read_free(ar);
+  cio_bundle_close(bundle);
 
   g_free(icon);
   g_free(plugin);
@@ -542,7 +1330,6 @@ cleanup:
   {
     g_log(DOMAIN, G_LOG_LEVEL_WARNING,
 	  "Failed to load plugin '%s'", filename);
-    g_free(provider);
     return NULL;
   }
 
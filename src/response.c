@@ -0,0 +1,573 @@
+/*
+ * This file is part of cast.io
+ *
+ * Copyright 2014 Henrik Andersson <henrik.4e@gmail.com>
+ *
+ * cast.io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cast.io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cast.io.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+
+#include "response.h"
+
+/* size of a chunk written to a streamed response, a response of one
+   chunk is sent at once */
+#define RESPONSE_CHUNK_SIZE 16384
+
+/* spaces per level of pretty printed json */
+#define RESPONSE_INDENT 2
+
+#define JSON_MIME_TYPE "application/json; charset=utf-8"
+
+/* an array or object which members are being written */
+typedef struct _response_frame_t
+{
+  JsonNode *node;
+  GList *members;
+  GList *member;
+  guint index;
+  gboolean first;
+} _response_frame_t;
+
+/* a response written a chunk at a time as compact json generated from
+   a tree member by member or taken from a buffer, pretty printed from
+   the compact json if requested */
+typedef struct _response_stream_t
+{
+  SoupServer *server;
+  SoupMessage *msg;
+  gboolean complete;
+
+  JsonNode *root;
+  JsonGenerator *gen;
+  GSList *frames;
+  gboolean started;
+
+  SoupBuffer *buffer;
+  gsize offset;
+
+  /* state of pretty printing, opened is set after the start of an
+     array or object until it is known to be empty */
+  gboolean pretty;
+  guint depth;
+  gboolean string;
+  gboolean escape;
+  gboolean opened;
+} _response_stream_t;
+
+static void
+_response_generate(_response_stream_t *stream, JsonNode *node, GString *out)
+{
+  gsize length;
+  gchar *content;
+
+  json_generator_set_root(stream->gen, node);
+  content = json_generator_to_data(stream->gen, &length);
+  g_string_append_len(out, content, length);
+  g_free(content);
+}
+
+static void
+_response_generate_name(_response_stream_t *stream, const gchar *name, GString *out)
+{
+  JsonNode *node;
+
+  node = json_node_alloc();
+  json_node_init_string(node, name);
+  _response_generate(stream, node, out);
+  json_node_free(node);
+
+  g_string_append_c(out, ':');
+}
+
+static void
+_response_frame_push(_response_stream_t *stream, JsonNode *node, GString *out)
+{
+  _response_frame_t *frame;
+
+  frame = g_new0(_response_frame_t, 1);
+  frame->node = node;
+  frame->first = TRUE;
+
+  if (JSON_NODE_HOLDS_OBJECT(node))
+  {
+    frame->members = json_object_get_members(json_node_get_object(node));
+    frame->member = frame->members;
+    g_string_append_c(out, '{');
+  }
+  else
+    g_string_append_c(out, '[');
+
+  stream->frames = g_slist_prepend(stream->frames, frame);
+}
+
+static void
+_response_frame_pop(_response_stream_t *stream, GString *out)
+{
+  _response_frame_t *frame;
+
+  frame = stream->frames->data;
+  g_string_append_c(out, JSON_NODE_HOLDS_OBJECT(frame->node) ? '}' : ']');
+
+  stream->frames = g_slist_delete_link(stream->frames, stream->frames);
+  g_list_free(frame->members);
+  g_free(frame);
+}
+
+/** generate the next chunk of compact json of the tree, containers
+    are written member by member and values at once */
+static void
+_response_tree_fill(_response_stream_t *stream, GString *out)
+{
+  const gchar *name;
+  JsonNode *element;
+  _response_frame_t *frame;
+
+  if (!stream->started)
+  {
+    stream->started = TRUE;
+    if (!JSON_NODE_HOLDS_ARRAY(stream->root) && !JSON_NODE_HOLDS_OBJECT(stream->root))
+    {
+      _response_generate(stream, stream->root, out);
+      return;
+    }
+    _response_frame_push(stream, stream->root, out);
+  }
+
+  while (stream->frames && out->len < RESPONSE_CHUNK_SIZE)
+  {
+    frame = stream->frames->data;
+    name = NULL;
+
+    if (JSON_NODE_HOLDS_OBJECT(frame->node))
+    {
+      if (frame->member == NULL)
+      {
+	_response_frame_pop(stream, out);
+	continue;
+      }
+
+      name = frame->member->data;
+      frame->member = g_list_next(frame->member);
+      element = json_object_get_member(json_node_get_object(frame->node), name);
+    }
+    else
+    {
+      if (frame->index >= json_array_get_length(json_node_get_array(frame->node)))
+      {
+	_response_frame_pop(stream, out);
+	continue;
+      }
+
+      element = json_array_get_element(json_node_get_array(frame->node), frame->index++);
+    }
+
+    if (!frame->first)
+      g_string_append_c(out, ',');
+    frame->first = FALSE;
+
+    if (name)
+      _response_generate_name(stream, name, out);
+
+    if (JSON_NODE_HOLDS_ARRAY(element) || JSON_NODE_HOLDS_OBJECT(element))
+      _response_frame_push(stream, element, out);
+    else
+      _response_generate(stream, element, out);
+  }
+}
+
+static void
+_response_indent(_response_stream_t *stream, GString *out)
+{
+  g_string_append_c(out, '\n');
+  g_string_append_printf(out, "%*s", stream->depth * RESPONSE_INDENT, "");
+}
+
+/** pretty print length bytes of compact json, the state is kept
+    between chunks of the same response */
+static void
+_response_pretty_print(_response_stream_t *stream, const gchar *text, gsize length,
+		       GString *out)
+{
+  gsize i;
+  gchar c;
+
+  for (i = 0; i < length; i++)
+  {
+    c = text[i];
+
+    if (stream->string)
+    {
+      g_string_append_c(out, c);
+      if (stream->escape)
+	stream->escape = FALSE;
+      else if (c == '\\')
+	stream->escape = TRUE;
+      else if (c == '"')
+	stream->string = FALSE;
+      continue;
+    }
+
+    /* an empty array or object is kept on one line */
+    if (stream->opened)
+    {
+      stream->opened = FALSE;
+      if (c == '}' || c == ']')
+      {
+	stream->depth--;
+	g_string_append_c(out, c);
+	continue;
+      }
+      _response_indent(stream, out);
+    }
+
+    switch (c)
+    {
+    case '{':
+    case '[':
+      g_string_append_c(out, c);
+      stream->depth++;
+      stream->opened = TRUE;
+      break;
+
+    case '}':
+    case ']':
+      stream->depth--;
+      _response_indent(stream, out);
+      g_string_append_c(out, c);
+      break;
+
+    case ',':
+      g_string_append_c(out, c);
+      _response_indent(stream, out);
+      break;
+
+    case ':':
+      g_string_append(out, " : ");
+      break;
+
+    case '"':
+      stream->string = TRUE;
+      g_string_append_c(out, c);
+      break;
+
+    case ' ':
+    case '\t':
+    case '\n':
+    case '\r':
+      break;
+
+    default:
+      g_string_append_c(out, c);
+    }
+  }
+}
+
+static gboolean
+_response_stream_done(_response_stream_t *stream)
+{
+  if (stream->buffer)
+    return stream->offset >= stream->buffer->length;
+
+  return stream->started && stream->frames == NULL;
+}
+
+/** get the next chunk of the response, NULL if there is none */
+static SoupBuffer *
+_response_stream_next(_response_stream_t *stream)
+{
+  gsize length;
+  GString *out;
+  GString *text;
+  SoupBuffer *chunk;
+
+  if (_response_stream_done(stream))
+    return NULL;
+
+  if (stream->buffer)
+  {
+    length = MIN(RESPONSE_CHUNK_SIZE, stream->buffer->length - stream->offset);
+
+    /* a compact buffer is written as is */
+    if (!stream->pretty)
+    {
+      chunk = soup_buffer_new_subbuffer(stream->buffer, stream->offset, length);
+      stream->offset += length;
+      return chunk;
+    }
+
+    out = g_string_sized_new(length * 2);
+    _response_pretty_print(stream, stream->buffer->data + stream->offset, length, out);
+    stream->offset += length;
+  }
+  else
+  {
+    out = g_string_sized_new(RESPONSE_CHUNK_SIZE);
+    _response_tree_fill(stream, out);
+
+    if (stream->pretty)
+    {
+      text = out;
+      out = g_string_sized_new(text->len * 2);
+      _response_pretty_print(stream, text->str, text->len, out);
+      g_string_free(text, TRUE);
+    }
+  }
+
+  if (out->len == 0)
+  {
+    g_string_free(out, TRUE);
+    return NULL;
+  }
+
+  length = out->len;
+  return soup_buffer_new(SOUP_MEMORY_TAKE, g_string_free(out, FALSE), length);
+}
+
+static void
+_response_stream_free(_response_stream_t *stream)
+{
+  _response_frame_t *frame;
+
+  while (stream->frames)
+  {
+    frame = stream->frames->data;
+    g_list_free(frame->members);
+    g_free(frame);
+    stream->frames = g_slist_delete_link(stream->frames, stream->frames);
+  }
+
+  if (stream->gen)
+    g_object_unref(stream->gen);
+  if (stream->root)
+    json_node_free(stream->root);
+  if (stream->buffer)
+    soup_buffer_free(stream->buffer);
+  g_free(stream);
+}
+
+/** write next chunk of the response */
+static void
+_response_stream_fill(_response_stream_t *stream)
+{
+  SoupBuffer *chunk;
+
+  chunk = _response_stream_next(stream);
+  if (chunk)
+  {
+    soup_message_body_append_buffer(stream->msg->response_body, chunk);
+    soup_buffer_free(chunk);
+  }
+
+  if (_response_stream_done(stream))
+  {
+    soup_message_body_complete(stream->msg->response_body);
+    stream->complete = TRUE;
+  }
+
+  soup_server_unpause_message(stream->server, stream->msg);
+}
+
+static void
+_response_stream_wrote_chunk(SoupMessage *msg, gpointer user_data)
+{
+  _response_stream_t *stream;
+  stream = (_response_stream_t *)user_data;
+
+  if (!stream->complete)
+    _response_stream_fill(stream);
+}
+
+static void
+_response_stream_finished(SoupMessage *msg, gpointer user_data)
+{
+  _response_stream_t *stream;
+  stream = (_response_stream_t *)user_data;
+
+  g_signal_handlers_disconnect_by_data(msg, stream);
+  _response_stream_free(stream);
+}
+
+/** send the response of one chunk at once, a larger response is
+    written in chunks as the previous chunk is sent */
+static void
+_response_stream_start(_response_stream_t *stream)
+{
+  SoupBuffer *chunk;
+  SoupMessage *msg;
+
+  msg = stream->msg;
+  soup_message_headers_set_content_type(msg->response_headers, JSON_MIME_TYPE, NULL);
+
+  chunk = _response_stream_next(stream);
+  if (_response_stream_done(stream))
+  {
+    if (chunk)
+    {
+      soup_message_body_append_buffer(msg->response_body, chunk);
+      soup_buffer_free(chunk);
+    }
+    _response_stream_free(stream);
+    return;
+  }
+
+  soup_message_headers_set_encoding(msg->response_headers, SOUP_ENCODING_CHUNKED);
+  soup_message_body_set_accumulate(msg->response_body, FALSE);
+
+  g_signal_connect(msg, "wrote-chunk",
+		   G_CALLBACK(_response_stream_wrote_chunk), stream);
+  g_signal_connect(msg, "finished",
+		   G_CALLBACK(_response_stream_finished), stream);
+
+  if (chunk)
+  {
+    soup_message_body_append_buffer(msg->response_body, chunk);
+    soup_buffer_free(chunk);
+  }
+  soup_server_unpause_message(stream->server, msg);
+}
+
+static gint
+_response_fields_compare(gconstpointer a, gconstpointer b)
+{
+  return strcmp(*(const gchar **)a, *(const gchar **)b);
+}
+
+/** copy member at path of from into to */
+static void
+_response_project_path(JsonObject *from, JsonObject *to, const gchar *path)
+{
+  gchar *name;
+  const gchar *dot;
+  JsonNode *node;
+  JsonNode *child;
+
+  dot = strchr(path, '.');
+  if (dot == NULL)
+  {
+    node = json_object_get_member(from, path);
+    if (node)
+      json_object_set_member(to, path, json_node_copy(node));
+    return;
+  }
+
+  name = g_strndup(path, dot - path);
+  node = json_object_get_member(from, name);
+  if (node && JSON_NODE_HOLDS_OBJECT(node))
+  {
+    if (!json_object_has_member(to, name))
+      json_object_set_object_member(to, name, json_object_new());
+
+    child = json_object_get_member(to, name);
+    if (JSON_NODE_HOLDS_OBJECT(child))
+      _response_project_path(json_node_get_object(node),
+			     json_node_get_object(child), dot + 1);
+  }
+  g_free(name);
+}
+
+gchar **
+cio_response_fields(GHashTable *query)
+{
+  gchar **it;
+  gchar **names;
+  const gchar *value;
+  GPtrArray *fields;
+
+  value = query ? g_hash_table_lookup(query, "fields") : NULL;
+  if (value == NULL)
+    return NULL;
+
+  fields = g_ptr_array_new();
+  names = g_strsplit(value, ",", -1);
+  for (it = names; *it; it++)
+  {
+    g_strstrip(*it);
+    if (**it)
+      g_ptr_array_add(fields, g_strdup(*it));
+  }
+  g_strfreev(names);
+
+  if (fields->len == 0)
+  {
+    g_ptr_array_free(fields, TRUE);
+    return NULL;
+  }
+
+  /* a parent path is projected before its members */
+  g_ptr_array_sort(fields, _response_fields_compare);
+  g_ptr_array_add(fields, NULL);
+  return (gchar **)g_ptr_array_free(fields, FALSE);
+}
+
+JsonNode *
+cio_response_project(JsonNode *item, gchar **fields)
+{
+  gchar **it;
+  JsonNode *node;
+  JsonObject *object;
+
+  if (!JSON_NODE_HOLDS_OBJECT(item))
+    return json_node_copy(item);
+
+  object = json_object_new();
+  for (it = fields; *it; it++)
+    _response_project_path(json_node_get_object(item), object, *it);
+
+  node = json_node_alloc();
+  json_node_init_object(node, object);
+  json_object_unref(object);
+  return node;
+}
+
+gboolean
+cio_response_pretty(GHashTable *query)
+{
+  const gchar *value;
+
+  value = query ? g_hash_table_lookup(query, "pretty") : NULL;
+  return (value && g_strcmp0(value, "0") != 0);
+}
+
+void
+cio_response_json(SoupServer *server, SoupMessage *msg, JsonNode *root,
+		  gboolean pretty)
+{
+  _response_stream_t *stream;
+
+  stream = g_new0(_response_stream_t, 1);
+  stream->server = server;
+  stream->msg = msg;
+  stream->root = root;
+  stream->gen = json_generator_new();
+  stream->pretty = pretty;
+
+  _response_stream_start(stream);
+}
+
+void
+cio_response_json_buffer(SoupServer *server, SoupMessage *msg, SoupBuffer *buffer,
+			 gboolean pretty)
+{
+  _response_stream_t *stream;
+
+  stream = g_new0(_response_stream_t, 1);
+  stream->server = server;
+  stream->msg = msg;
+  stream->buffer = soup_buffer_copy(buffer);
+  stream->pretty = pretty;
+
+  _response_stream_start(stream);
+}
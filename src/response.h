@@ -0,0 +1,50 @@
+/*
+ * This file is part of cast.io
+ *
+ * Copyright 2014 Henrik Andersson <henrik.4e@gmail.com>
+ *
+ * cast.io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cast.io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cast.io.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _response_h
+#define _response_h
+
+#include <glib.h>
+#include <libsoup/soup.h>
+#include <json-glib/json-glib.h>
+
+/** check if pretty printed json is requested by query */
+gboolean cio_response_pretty(GHashTable *query);
+
+/** get the sorted list of member paths requested by the fields
+    query attribute, NULL if all members are requested */
+gchar **cio_response_fields(GHashTable *query);
+
+/** create a copy of item with only the members of the dot separated
+    paths in fields */
+JsonNode *cio_response_project(JsonNode *item, gchar **fields);
+
+/** set root as json response of msg, a response larger than a chunk
+    is generated and written a chunk at a time while it is sent, root
+    is freed when the response is done */
+void cio_response_json(SoupServer *server, SoupMessage *msg, JsonNode *root,
+		       gboolean pretty);
+
+/** set compact json text in buffer as response of msg, written a
+    chunk at a time and pretty printed from the text if requested */
+void cio_response_json_buffer(SoupServer *server, SoupMessage *msg, SoupBuffer *buffer,
+			      gboolean pretty);
+
+#endif /* _response_h */
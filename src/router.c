@@ -0,0 +1,312 @@
+/*
+ * This file is part of cast.io
+ *
+ * Copyright 2014 Henrik Andersson <henrik.4e@gmail.com>
+ *
+ * cast.io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cast.io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cast.io.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "router.h"
+
+/* a route ending at a node, names are the parameter names of the
+   parameter segments of route in order */
+typedef struct _router_route_t
+{
+  gpointer data;
+  gchar **names;
+} _router_route_t;
+
+/* a route ending with a wildcard, prefix is the part of the last
+   segment before '*' */
+typedef struct _router_wildcard_t
+{
+  gchar *prefix;
+  _router_route_t route;
+} _router_wildcard_t;
+
+/* a node of the segment tree, children are keyed by static segment
+   and param is the child of a parameter segment */
+typedef struct _router_node_t
+{
+  GHashTable *children;
+  struct _router_node_t *param;
+  _router_route_t *route;
+  GPtrArray *wildcards;
+} _router_node_t;
+
+typedef struct cio_router_t
+{
+  _router_node_t *root;
+  GDestroyNotify free_func;
+} cio_router_t;
+
+static void
+_router_route_clear(cio_router_t *self, _router_route_t *route)
+{
+  if (self->free_func && route->data)
+    self->free_func(route->data);
+
+  g_strfreev(route->names);
+  route->data = NULL;
+  route->names = NULL;
+}
+
+static void
+_router_node_free(cio_router_t *self, _router_node_t *node)
+{
+  guint i;
+  GHashTableIter iter;
+  gpointer value;
+  _router_wildcard_t *wildcard;
+
+  if (node->children)
+  {
+    g_hash_table_iter_init(&iter, node->children);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+      _router_node_free(self, value);
+    g_hash_table_destroy(node->children);
+  }
+
+  if (node->param)
+    _router_node_free(self, node->param);
+
+  if (node->route)
+  {
+    _router_route_clear(self, node->route);
+    g_free(node->route);
+  }
+
+  for (i = 0; node->wildcards && i < node->wildcards->len; i++)
+  {
+    wildcard = g_ptr_array_index(node->wildcards, i);
+    _router_route_clear(self, &wildcard->route);
+    g_free(wildcard->prefix);
+    g_free(wildcard);
+  }
+
+  if (node->wildcards)
+    g_ptr_array_free(node->wildcards, TRUE);
+
+  g_free(node);
+}
+
+cio_router_t *
+cio_router_new(GDestroyNotify free_func)
+{
+  cio_router_t *router;
+
+  router = g_malloc(sizeof(cio_router_t));
+  memset(router, 0, sizeof(cio_router_t));
+
+  router->root = g_new0(_router_node_t, 1);
+  router->free_func = free_func;
+
+  return router;
+}
+
+void
+cio_router_destroy(cio_router_t *self)
+{
+  _router_node_free(self, self->root);
+  g_free(self);
+}
+
+gboolean
+cio_router_add(cio_router_t *self, const gchar *pattern, gpointer data)
+{
+  guint i;
+  gsize len;
+  gchar **segments;
+  gchar *segment;
+  GPtrArray *names;
+  _router_route_t *route;
+  _router_wildcard_t *wildcard;
+  _router_node_t *node, *child;
+
+  /* wildcard is only allowed at the end of pattern */
+  if (strchr(pattern, '*') && pattern[strlen(pattern) - 1] != '*')
+    return FALSE;
+
+  while (*pattern == '/')
+    pattern++;
+
+  segments = g_strsplit(pattern, "/", -1);
+  names = g_ptr_array_new();
+  node = self->root;
+  route = NULL;
+
+  for (i = 0; segments[i]; i++)
+  {
+    segment = segments[i];
+    len = strlen(segment);
+
+    /* add the last segment of a wildcard route */
+    if (len && segment[len - 1] == '*')
+    {
+      if (node->wildcards == NULL)
+	node->wildcards = g_ptr_array_new();
+
+      wildcard = g_new0(_router_wildcard_t, 1);
+      wildcard->prefix = g_strndup(segment, len - 1);
+      g_ptr_array_add(node->wildcards, wildcard);
+      route = &wildcard->route;
+      break;
+    }
+
+    /* walk or add a parameter segment */
+    if (segment[0] == ':')
+    {
+      if (segment[1] == '\0')
+      {
+	g_ptr_array_free(names, TRUE);
+	g_strfreev(segments);
+	return FALSE;
+      }
+
+      if (node->param == NULL)
+	node->param = g_new0(_router_node_t, 1);
+
+      g_ptr_array_add(names, g_strdup(segment + 1));
+      node = node->param;
+      continue;
+    }
+
+    /* walk or add a static segment, an empty pattern is the root */
+    if (len == 0 && segments[i + 1] == NULL && i == 0)
+      break;
+
+    if (node->children == NULL)
+      node->children = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    child = g_hash_table_lookup(node->children, segment);
+    if (child == NULL)
+    {
+      child = g_new0(_router_node_t, 1);
+      g_hash_table_insert(node->children, g_strdup(segment), child);
+    }
+    node = child;
+  }
+
+  if (route == NULL)
+  {
+    if (node->route == NULL)
+      node->route = g_new0(_router_route_t, 1);
+    route = node->route;
+  }
+
+  /* a registered route is replaced */
+  _router_route_clear(self, route);
+  g_ptr_array_add(names, NULL);
+  route->names = (gchar **)g_ptr_array_free(names, FALSE);
+  route->data = data;
+
+  g_strfreev(segments);
+  return TRUE;
+}
+
+/** match segments of path starting at p, NULL if p is past the last
+    segment, values of parameter segments are pushed to values */
+static _router_route_t *
+_router_match(_router_node_t *node, const gchar *p, GPtrArray *values,
+	      const gchar **rest)
+{
+  guint i;
+  gsize len;
+  gchar *segment;
+  const gchar *end;
+  const gchar *next;
+  _router_node_t *child;
+  _router_route_t *route;
+  _router_wildcard_t *wildcard;
+
+  if (p == NULL)
+    return node->route;
+
+  /* an empty last segment of a path ending with '/' ends the path */
+  end = strchr(p, '/');
+  len = end ? (gsize)(end - p) : strlen(p);
+  next = (end && end[1] != '\0') ? end + 1 : NULL;
+
+  /* static segment */
+  if (node->children)
+  {
+    segment = g_strndup(p, len);
+    child = g_hash_table_lookup(node->children, segment);
+    g_free(segment);
+
+    if (child && (route = _router_match(child, next, values, rest)))
+      return route;
+  }
+
+  /* parameter segment */
+  if (node->param && len > 0)
+  {
+    g_ptr_array_add(values, g_strndup(p, len));
+    if ((route = _router_match(node->param, next, values, rest)))
+      return route;
+
+    g_free(g_ptr_array_index(values, values->len - 1));
+    g_ptr_array_remove_index(values, values->len - 1);
+  }
+
+  /* wildcard matching the rest of path */
+  for (i = 0; node->wildcards && i < node->wildcards->len; i++)
+  {
+    wildcard = g_ptr_array_index(node->wildcards, i);
+    if (strncmp(p, wildcard->prefix, strlen(wildcard->prefix)) == 0)
+    {
+      *rest = p + strlen(wildcard->prefix);
+      return &wildcard->route;
+    }
+  }
+
+  return NULL;
+}
+
+gpointer
+cio_router_lookup(cio_router_t *self, const gchar *path,
+		  GHashTable **params, const gchar **rest)
+{
+  guint i;
+  GPtrArray *values;
+  _router_route_t *route;
+
+  *params = NULL;
+  *rest = NULL;
+
+  while (*path == '/')
+    path++;
+
+  /* root path */
+  if (*path == '\0' && self->root->route)
+    return self->root->route->data;
+
+  values = g_ptr_array_new_with_free_func(g_free);
+  route = _router_match(self->root, path, values, rest);
+
+  if (route && values->len)
+  {
+    *params = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    for (i = 0; i < values->len && route->names[i]; i++)
+      g_hash_table_insert(*params, g_strdup(route->names[i]),
+			  g_strdup(g_ptr_array_index(values, i)));
+  }
+
+  g_ptr_array_free(values, TRUE);
+  return route ? route->data : NULL;
+}
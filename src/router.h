@@ -0,0 +1,47 @@
+/*
+ * This file is part of cast.io
+ *
+ * Copyright 2014 Henrik Andersson <henrik.4e@gmail.com>
+ *
+ * cast.io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cast.io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cast.io.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _router_h
+#define _router_h
+
+#include <glib.h>
+
+struct cio_router_t;
+
+/** create a router, free_func is used to free data of routes */
+struct cio_router_t *cio_router_new(GDestroyNotify free_func);
+void cio_router_destroy(struct cio_router_t *self);
+
+/** add route of pattern with data, a segment ':name' of pattern
+    matches any segment as parameter name and a '*' at the end of
+    pattern matches the rest of path. Returns FALSE if pattern is
+    invalid */
+gboolean cio_router_add(struct cio_router_t *self, const gchar *pattern,
+			gpointer data);
+
+/** get data of the route matching path, NULL if no route matches.
+    Static segments are preferred before parameters and parameters
+    before a wildcard. Parameters are returned in a new hash table
+    of names and values if route has any, and rest points into path
+    at the part matched by a wildcard */
+gpointer cio_router_lookup(struct cio_router_t *self, const gchar *path,
+			   GHashTable **params, const gchar **rest);
+
+#endif /* _router_h */
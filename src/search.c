@@ -19,39 +19,1111 @@
  */
 
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <json-glib/json-glib.h>
 
 #include "search.h"
 #include "service.h"
 #include "settings.h"
 #include "provider.h"
+#include "index.h"
+#include "suggest.h"
+#include "response.h"
 
 #define DOMAIN "search"
 
+/* interval in seconds between runs of the job reaper */
+#define SEARCH_REAPER_INTERVAL 10
+
+/* maximum milliseconds a long-poll request waits for new items */
+#define SEARCH_MAX_WAIT 30000
+
 typedef struct cio_search_t
 {
-  GHashTable *jobs;
-} cio_search_t;
+  cio_service_t *service;
+  GHashTable *jobs;
+  GHashTable *cache;
+  guint reaper;
+
+  /* number of active streamed searches */
+  gint streams;
+
+  /* number of provider searches queued or running */
+  gint pending;
+} cio_search_t;
+
+/* cached search result of a provider */
+typedef struct _search_cache_entry_t
+{
+  gint64 expires;
+  JsonArray *items;
+} _search_cache_entry_t;
+
+/* merged search result entry */
+typedef struct _search_merge_entry_t
+{
+  guint index;
+  gdouble score;
+  gchar *provider;
+  gchar *uri;
+  gchar *title;
+  JsonNode *item;
+} _search_merge_entry_t;
+
+/* merge of provider results into the best scored items, entries are
+   kept in a min heap on score bounded to size entries */
+typedef struct _search_merge_t
+{
+  guint size;
+  GPtrArray *heap;
+  GHashTable *uris;
+  GHashTable *titles;
+  GHashTable *ranks;
+} _search_merge_t;
+
+typedef struct _search_job_t
+{
+  gint ref;
+  cio_search_t *search;
+  gchar id[33];
+
+  gchar **keywords;
+  gchar **types;
+  gchar *query;
+  gint providers;
+  JsonObject *result;
+
+  /* job lifecycle */
+  gboolean cancelled;
+  gint64 accessed;
+  gint items;
+  gint max_items;
+
+  /* streamed search, items are written to msg as they arrive */
+  gboolean streamed;
+  gboolean sse;
+  SoupServer *server;
+  SoupMessage *msg;
+
+  /* merged result view, NULL if not requested */
+  _search_merge_t *merge;
+
+  /* members of items in the result, NULL for all members */
+  gchar **fields;
+
+  /* page size and the next offset of each provider with more items */
+  gint limit;
+  JsonObject *next;
+
+  /* provider and uri of items added from the local index */
+  GHashTable *indexed;
+
+  /* long-poll requests waiting for the result to be updated */
+  gboolean updated;
+  GList *waiters;
+  guint wake;
+
+  /* deadline finishing the search with the items received so far */
+  guint timer;
+  gboolean expired;
+} _search_job_t;
+
+/* a parked long-poll request of a search result */
+typedef struct _search_waiter_t
+{
+  _search_job_t *job;
+  SoupServer *server;
+  SoupMessage *msg;
+  gboolean pretty;
+  guint timeout;
+} _search_waiter_t;
+
+/* decoded continuation cursor of a paged search */
+typedef struct _search_cursor_t
+{
+  JsonParser *parser;
+  const gchar *keywords;
+  const gchar *types;
+  gint limit;
+  JsonObject *offsets;
+} _search_cursor_t;
+
+static gint
+_search_setting(cio_search_t *self, const gchar *id, gint fallback)
+{
+  GError *err;
+  gint value;
+
+  err = NULL;
+  value = cio_settings_get_int_value(self->service->settings, "search", id, &err);
+  if (err)
+  {
+    g_clear_error(&err);
+    return fallback;
+  }
+
+  return value;
+}
+
+static gint
+_search_compare_words(gconstpointer a, gconstpointer b)
+{
+  return g_strcmp0(*(const gchar **)a, *(const gchar **)b);
+}
+
+/** normalize a list separated by '+' or space into a sorted, lower
+    case list without duplicates separated by '+' */
+static gchar *
+_search_normalize(const gchar *list)
+{
+  guint i;
+  gchar *lower;
+  gchar *result;
+  gchar **tokens, **it;
+  GPtrArray *words;
+
+  if (list == NULL)
+    return g_strdup("");
+
+  lower = g_utf8_strdown(list, -1);
+  g_strdelimit(lower, " \t", '+');
+  tokens = g_strsplit(lower, "+", -1);
+  g_free(lower);
+
+  words = g_ptr_array_new();
+  for (it = tokens; *it; it++)
+  {
+    if (**it != '\0')
+      g_ptr_array_add(words, *it);
+  }
+
+  g_ptr_array_sort(words, _search_compare_words);
+
+  /* remove duplicates */
+  for (i = 1; i < words->len;)
+  {
+    if (g_strcmp0(g_ptr_array_index(words, i - 1), g_ptr_array_index(words, i)) == 0)
+      g_ptr_array_remove_index(words, i);
+    else
+      i++;
+  }
+
+  g_ptr_array_add(words, NULL);
+  result = g_strjoinv("+", (gchar **)words->pdata);
+  g_ptr_array_free(words, TRUE);
+  g_strfreev(tokens);
+
+  return result;
+}
+
+static void
+_search_cache_entry_free(_search_cache_entry_t *entry)
+{
+  json_array_unref(entry->items);
+  g_free(entry);
+}
+
+/** lookup a non expired provider result in search cache */
+static JsonArray *
+_search_cache_lookup(cio_search_t *self, const gchar *key)
+{
+  _search_cache_entry_t *entry;
+
+  entry = g_hash_table_lookup(self->cache, key);
+  if (entry == NULL)
+    return NULL;
+
+  if (entry->expires <= g_get_monotonic_time())
+  {
+    g_hash_table_remove(self->cache, key);
+    return NULL;
+  }
+
+  return json_array_ref(entry->items);
+}
+
+/** remove expired entries from search cache, returns number of
+    entries left */
+static guint
+_search_cache_expire(cio_search_t *self)
+{
+  gint64 now;
+  gpointer value;
+  GHashTableIter iter;
+
+  now = g_get_monotonic_time();
+  g_hash_table_iter_init(&iter, self->cache);
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+  {
+    if (((_search_cache_entry_t *)value)->expires <= now)
+      g_hash_table_iter_remove(&iter);
+  }
+
+  return g_hash_table_size(self->cache);
+}
+
+/** store a provider result in search cache */
+static void
+_search_cache_store(cio_search_t *self, const gchar *key, JsonArray *items)
+{
+  gint ttl, size;
+  gpointer k, value;
+  gpointer oldest;
+  gint64 expires;
+  GHashTableIter iter;
+  _search_cache_entry_t *entry;
+
+  ttl = _search_setting(self, "cache_ttl", 600);
+  size = _search_setting(self, "cache_size", 256);
+  if (ttl <= 0 || size <= 0)
+    return;
+
+  /* make room for the entry, evict the one closest to expire */
+  if (_search_cache_expire(self) >= (guint)size)
+  {
+    oldest = NULL;
+    expires = G_MAXINT64;
+    g_hash_table_iter_init(&iter, self->cache);
+    while (g_hash_table_iter_next(&iter, &k, &value))
+    {
+      entry = (_search_cache_entry_t *)value;
+      if (entry->expires < expires)
+      {
+	expires = entry->expires;
+	oldest = k;
+      }
+    }
+
+    if (oldest)
+      g_hash_table_remove(self->cache, oldest);
+  }
+
+  entry = g_new0(_search_cache_entry_t, 1);
+  entry->expires = g_get_monotonic_time() + (gint64)ttl * G_USEC_PER_SEC;
+  entry->items = json_array_ref(items);
+  g_hash_table_replace(self->cache, g_strdup(key), entry);
+}
+
+static const gchar *
+_search_item_string(JsonObject *object, const gchar *member)
+{
+  JsonNode *node;
+
+  if (object == NULL || !json_object_has_member(object, member))
+    return NULL;
+
+  node = json_object_get_member(object, member);
+  if (!JSON_NODE_HOLDS_VALUE(node) || json_node_get_value_type(node) != G_TYPE_STRING)
+    return NULL;
+
+  return json_node_get_string(node);
+}
+
+static JsonObject *
+_search_item_metadata(JsonNode *item)
+{
+  JsonNode *node;
+  JsonObject *object;
+
+  if (!JSON_NODE_HOLDS_OBJECT(item))
+    return NULL;
+
+  object = json_node_get_object(item);
+  if (!json_object_has_member(object, "metadata"))
+    return NULL;
+
+  node = json_object_get_member(object, "metadata");
+  if (!JSON_NODE_HOLDS_OBJECT(node))
+    return NULL;
+
+  return json_node_get_object(node);
+}
+
+/** score how well a metadata member matches the keywords */
+static gdouble
+_search_score_member(JsonObject *metadata, const gchar *member,
+		     gchar **keywords, gdouble weight)
+{
+  gchar **it;
+  gchar *text;
+  const gchar *value;
+  gdouble score;
+
+  value = _search_item_string(metadata, member);
+  if (value == NULL)
+    return 0.0;
+
+  score = 0.0;
+  text = g_utf8_strdown(value, -1);
+  for (it = keywords; *it; it++)
+  {
+    if (**it != '\0' && strstr(text, *it) != NULL)
+      score += weight;
+  }
+  g_free(text);
+
+  return score;
+}
+
+/** score an item against the keywords, rank is the position of item
+    in the provider result which is used as a tie breaker */
+static gdouble
+_search_score_item(JsonNode *item, gchar **keywords, guint rank)
+{
+  gdouble score;
+  JsonObject *metadata;
+
+  score = 1.0 / (rank + 1);
+
+  metadata = _search_item_metadata(item);
+  if (metadata == NULL)
+    return score;
+
+  score += _search_score_member(metadata, "title", keywords, 3.0);
+  score += _search_score_member(metadata, "artist", keywords, 2.0);
+  score += _search_score_member(metadata, "description", keywords, 1.0);
+
+  return score;
+}
+
+static _search_merge_t *
+_search_merge_new(guint size)
+{
+  _search_merge_t *merge;
+  merge = g_new0(_search_merge_t, 1);
+  merge->size = size;
+  merge->heap = g_ptr_array_new();
+  merge->uris = g_hash_table_new(g_str_hash, g_str_equal);
+  merge->titles = g_hash_table_new(g_str_hash, g_str_equal);
+  merge->ranks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  return merge;
+}
+
+static void
+_search_merge_entry_clear(_search_merge_entry_t *entry)
+{
+  g_free(entry->provider);
+  g_free(entry->uri);
+  g_free(entry->title);
+  if (entry->item)
+    json_node_free(entry->item);
+  entry->provider = entry->uri = entry->title = NULL;
+  entry->item = NULL;
+}
+
+static void
+_search_merge_free(_search_merge_t *merge)
+{
+  guint i;
+
+  for (i = 0; i < merge->heap->len; i++)
+  {
+    _search_merge_entry_clear(g_ptr_array_index(merge->heap, i));
+    g_free(g_ptr_array_index(merge->heap, i));
+  }
+
+  g_ptr_array_free(merge->heap, TRUE);
+  g_hash_table_destroy(merge->uris);
+  g_hash_table_destroy(merge->titles);
+  g_hash_table_destroy(merge->ranks);
+  g_free(merge);
+}
+
+static void
+_search_merge_swap(GPtrArray *heap, guint a, guint b)
+{
+  gpointer tmp;
+
+  tmp = heap->pdata[a];
+  heap->pdata[a] = heap->pdata[b];
+  heap->pdata[b] = tmp;
+
+  ((_search_merge_entry_t *)heap->pdata[a])->index = a;
+  ((_search_merge_entry_t *)heap->pdata[b])->index = b;
+}
+
+#define _SEARCH_MERGE_SCORE(heap, i) (((_search_merge_entry_t *)(heap)->pdata[i])->score)
+
+static void
+_search_merge_sift_up(GPtrArray *heap, guint i)
+{
+  guint parent;
+
+  while (i > 0)
+  {
+    parent = (i - 1) / 2;
+    if (_SEARCH_MERGE_SCORE(heap, parent) <= _SEARCH_MERGE_SCORE(heap, i))
+      break;
+
+    _search_merge_swap(heap, parent, i);
+    i = parent;
+  }
+}
+
+static void
+_search_merge_sift_down(GPtrArray *heap, guint i)
+{
+  guint l, r, min;
+
+  while (1)
+  {
+    l = 2 * i + 1;
+    r = l + 1;
+    min = i;
+
+    if (l < heap->len && _SEARCH_MERGE_SCORE(heap, l) < _SEARCH_MERGE_SCORE(heap, min))
+      min = l;
+
+    if (r < heap->len && _SEARCH_MERGE_SCORE(heap, r) < _SEARCH_MERGE_SCORE(heap, min))
+      min = r;
+
+    if (min == i)
+      break;
+
+    _search_merge_swap(heap, i, min);
+    i = min;
+  }
+}
+
+/** remove the dedup keys of entry */
+static void
+_search_merge_forget(_search_merge_t *merge, _search_merge_entry_t *entry)
+{
+  if (entry->uri && g_hash_table_lookup(merge->uris, entry->uri) == entry)
+    g_hash_table_remove(merge->uris, entry->uri);
+
+  if (entry->title && g_hash_table_lookup(merge->titles, entry->title) == entry)
+    g_hash_table_remove(merge->titles, entry->title);
+}
+
+/** set entry values and add its dedup keys */
+static void
+_search_merge_remember(_search_merge_t *merge, _search_merge_entry_t *entry,
+		       const gchar *provider, gchar *uri, gchar *title,
+		       JsonNode *item, gdouble score)
+{
+  _search_merge_entry_clear(entry);
+
+  entry->provider = g_strdup(provider);
+  entry->uri = uri;
+  entry->title = title;
+  entry->item = json_node_copy(item);
+  entry->score = score;
+
+  if (entry->uri)
+    g_hash_table_replace(merge->uris, entry->uri, entry);
+
+  if (entry->title)
+    g_hash_table_replace(merge->titles, entry->title, entry);
+}
+
+/** add an item to merged result, the item replaces a duplicate of
+    lower score or the lowest scored item if merge is full */
+static void
+_search_merge_add(_search_merge_t *merge, cio_provider_descriptor_t *provider,
+		  JsonNode *item, gchar **keywords)
+{
+  guint rank;
+  gdouble score;
+  gchar *uri, *title;
+  const gchar *value;
+  _search_merge_entry_t *entry;
+
+  /* score item, using the position in provider result as tie breaker */
+  rank = GPOINTER_TO_UINT(g_hash_table_lookup(merge->ranks, provider->id));
+  g_hash_table_replace(merge->ranks, g_strdup(provider->id), GUINT_TO_POINTER(rank + 1));
+  score = _search_score_item(item, keywords, rank);
+
+  /* dedup keys of item */
+  uri = title = NULL;
+  if (JSON_NODE_HOLDS_OBJECT(item))
+  {
+    value = _search_item_string(json_node_get_object(item), "uri");
+    if (value)
+      uri = g_strdup(value);
+  }
+
+  value = _search_item_string(_search_item_metadata(item), "title");
+  if (value)
+  {
+    title = g_utf8_strdown(value, -1);
+    g_strstrip(title);
+  }
+
+  /* lookup a duplicate of item */
+  entry = NULL;
+  if (uri)
+    entry = g_hash_table_lookup(merge->uris, uri);
+  if (entry == NULL && title)
+    entry = g_hash_table_lookup(merge->titles, title);
+
+  /* replace duplicate if item has a better score */
+  if (entry)
+  {
+    if (score <= entry->score)
+      goto drop;
+
+    _search_merge_forget(merge, entry);
+    _search_merge_remember(merge, entry, provider->id, uri, title, item, score);
+    _search_merge_sift_down(merge->heap, entry->index);
+    return;
+  }
+
+  /* replace the lowest scored item if merge is full */
+  if (merge->heap->len >= merge->size)
+  {
+    entry = g_ptr_array_index(merge->heap, 0);
+    if (score <= entry->score)
+      goto drop;
+
+    _search_merge_forget(merge, entry);
+    _search_merge_remember(merge, entry, provider->id, uri, title, item, score);
+    _search_merge_sift_down(merge->heap, 0);
+    return;
+  }
+
+  /* add new entry to heap */
+  entry = g_new0(_search_merge_entry_t, 1);
+  entry->index = merge->heap->len;
+  g_ptr_array_add(merge->heap, entry);
+  _search_merge_remember(merge, entry, provider->id, uri, title, item, score);
+  _search_merge_sift_up(merge->heap, entry->index);
+  return;
+
+drop:
+  g_free(uri);
+  g_free(title);
+}
+
+static gint
+_search_merge_compare(gconstpointer a, gconstpointer b)
+{
+  gdouble sa, sb;
+  sa = (*(_search_merge_entry_t **)a)->score;
+  sb = (*(_search_merge_entry_t **)b)->score;
+  return (sa < sb) ? 1 : ((sa > sb) ? -1 : 0);
+}
+
+/** get merged result as an array sorted on score */
+static JsonArray *
+_search_merge_results(_search_merge_t *merge, gchar **fields)
+{
+  guint i;
+  GPtrArray *sorted;
+  JsonArray *array;
+  JsonObject *object;
+  _search_merge_entry_t *entry;
+
+  sorted = g_ptr_array_sized_new(merge->heap->len);
+  for (i = 0; i < merge->heap->len; i++)
+    g_ptr_array_add(sorted, g_ptr_array_index(merge->heap, i));
+  g_ptr_array_sort(sorted, _search_merge_compare);
+
+  array = json_array_new();
+  for (i = 0; i < sorted->len; i++)
+  {
+    entry = g_ptr_array_index(sorted, i);
+    object = json_object_new();
+    json_object_set_string_member(object, "provider", entry->provider);
+    json_object_set_double_member(object, "score", entry->score);
+    json_object_set_member(object, "item",
+			   fields ? cio_response_project(entry->item, fields)
+			   : json_node_copy(entry->item));
+    json_array_add_object_element(array, object);
+  }
+
+  g_ptr_array_free(sorted, TRUE);
+  return array;
+}
+
+/** create an unpredictable job id as a hex string */
+static void
+_search_job_id(gchar *id, gsize size)
+{
+  int fh;
+  gsize i;
+  guint8 bytes[16];
+
+  g_assert(size > sizeof(bytes) * 2);
+
+  fh = open("/dev/urandom", O_RDONLY);
+  if (fh == -1 || read(fh, bytes, sizeof(bytes)) != sizeof(bytes))
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	  "Failed to read random search job id, using pseudo random id.");
+    for (i = 0; i < sizeof(bytes); i++)
+      bytes[i] = g_random_int() & 0xff;
+  }
+
+  if (fh != -1)
+    close(fh);
+
+  for (i = 0; i < sizeof(bytes); i++)
+    g_snprintf(id + i * 2, 3, "%.2x", bytes[i]);
+}
+
+static _search_job_t *
+_search_job_ctor(cio_search_t *search, const char *keywords,
+		 const char *types, gint top, gint limit)
+{
+  _search_job_t *job;
+  job = g_new0(_search_job_t, 1);
+  job->ref = 1;
+  job->search = search;
+  job->result = json_object_new();
+  job->accessed = g_get_monotonic_time();
+  job->max_items = _search_setting(search, "max_items", 500);
+  job->keywords = g_strsplit(keywords, "+", -1);
+  job->limit = limit;
+  job->next = json_object_new();
+
+  if (top > 0)
+    job->merge = _search_merge_new(top);
+
+  if (types)
+    job->types = g_strsplit(types, "+", -1);
+
+  return job;
+}
+
+static _search_job_t *
+_search_job_ref(_search_job_t *job)
+{
+  job->ref++;
+  return job;
+}
+
+static void
+_search_job_unref(_search_job_t *job)
+{
+  if (--job->ref > 0)
+    return;
+
+  if (job->types)
+    g_strfreev(job->types);
+  g_strfreev(job->fields);
+  if (job->merge)
+    _search_merge_free(job->merge);
+  if (job->indexed)
+    g_hash_table_destroy(job->indexed);
+  g_strfreev(job->keywords);
+  g_free(job->query);
+  json_object_unref(job->result);
+  json_object_unref(job->next);
+  g_free(job);
+}
+
+/** build the uri continuing a search with the next page of providers
+    which returned a full page, NULL if there are no more items */
+static gchar *
+_search_job_next(_search_job_t *job)
+{
+  gsize length;
+  gchar *content;
+  gchar *token;
+  gchar *uri;
+  gchar *value;
+  JsonNode *node;
+  JsonObject *object;
+  JsonGenerator *gen;
+
+  if (json_object_get_size(job->next) == 0)
+    return NULL;
+
+  object = json_object_new();
+
+  value = g_strjoinv("+", job->keywords);
+  json_object_set_string_member(object, "keywords", value);
+  g_free(value);
+
+  if (job->types)
+  {
+    value = g_strjoinv("+", job->types);
+    json_object_set_string_member(object, "types", value);
+    g_free(value);
+  }
+
+  json_object_set_int_member(object, "limit", job->limit);
+  json_object_set_object_member(object, "offsets", json_object_ref(job->next));
+
+  node = json_node_alloc();
+  json_node_init_object(node, object);
+
+  gen = json_generator_new();
+  json_generator_set_root(gen, node);
+  content = json_generator_to_data(gen, &length);
+  g_object_unref(gen);
+  json_node_free(node);
+  json_object_unref(object);
+
+  /* encode as url safe base64 without padding */
+  token = g_base64_encode((const guchar *)content, length);
+  g_strdelimit(token, "+", '-');
+  g_strdelimit(token, "/", '_');
+  if ((value = strchr(token, '=')) != NULL)
+    *value = '\0';
+
+  uri = g_strdup_printf("/search?cursor=%s", token);
+  g_free(token);
+  g_free(content);
+  return uri;
+}
+
+static void
+_search_cursor_free(_search_cursor_t *cursor)
+{
+  g_object_unref(cursor->parser);
+  g_free(cursor);
+}
+
+/** decode a cursor created by _search_job_next(), returns NULL if
+    the cursor is invalid */
+static _search_cursor_t *
+_search_cursor_decode(const gchar *token)
+{
+  gsize length;
+  guchar *content;
+  gchar *padded;
+  JsonNode *node;
+  JsonObject *object;
+  _search_cursor_t *cursor;
+
+  /* restore padding and alphabet of standard base64 */
+  length = strlen(token);
+  padded = g_strnfill(((length + 3) / 4) * 4, '=');
+  memcpy(padded, token, length);
+  g_strdelimit(padded, "-", '+');
+  g_strdelimit(padded, "_", '/');
+  content = g_base64_decode(padded, &length);
+  g_free(padded);
+
+  cursor = g_new0(_search_cursor_t, 1);
+  cursor->parser = json_parser_new();
+
+  if (length == 0
+      || !json_parser_load_from_data(cursor->parser, (const gchar *)content, length, NULL))
+    goto invalid;
+
+  node = json_parser_get_root(cursor->parser);
+  if (node == NULL || !JSON_NODE_HOLDS_OBJECT(node))
+    goto invalid;
+
+  object = json_node_get_object(node);
+  cursor->keywords = _search_item_string(object, "keywords");
+  cursor->types = _search_item_string(object, "types");
+  if (cursor->keywords == NULL
+      || !json_object_has_member(object, "limit")
+      || !json_object_has_member(object, "offsets"))
+    goto invalid;
+
+  node = json_object_get_member(object, "offsets");
+  if (!JSON_NODE_HOLDS_OBJECT(node))
+    goto invalid;
+
+  cursor->offsets = json_node_get_object(node);
+  cursor->limit = json_object_get_int_member(object, "limit");
+  g_free(content);
+  return cursor;
+
+invalid:
+  g_free(content);
+  _search_cursor_free(cursor);
+  return NULL;
+}
+
+/** client closed the connection of a streamed search */
+static void
+_search_job_stream_finished(SoupMessage *msg, gpointer user_data)
+{
+  _search_job_t *job;
+  job = (_search_job_t *)user_data;
+
+  g_log(DOMAIN, G_LOG_LEVEL_DEBUG,
+	"Client closed streamed search before it was finished.");
+
+  job->msg = NULL;
+  job->cancelled = TRUE;
+}
+
+/** write a json object as one chunk on the streamed search response */
+static void
+_search_job_stream_write(_search_job_t *job, JsonObject *object)
+{
+  gsize length;
+  gchar *content;
+  gchar *chunk;
+  JsonNode *node;
+  JsonGenerator *gen;
+
+  if (job->msg == NULL)
+    return;
+
+  node = json_node_alloc();
+  json_node_init_object(node, object);
+
+  gen = json_generator_new();
+  json_generator_set_root(gen, node);
+  content = json_generator_to_data(gen, &length);
+  g_object_unref(gen);
+  json_node_free(node);
+
+  /* frame the chunk as a server-sent event or a json line */
+  if (job->sse)
+    chunk = g_strdup_printf("data: %s\n\n", content);
+  else
+    chunk = g_strdup_printf("%s\n", content);
+  g_free(content);
+
+  soup_message_body_append(job->msg->response_body, SOUP_MEMORY_TAKE,
+			   chunk, strlen(chunk));
+  soup_server_unpause_message(job->server, job->msg);
+}
+
+/** complete the streamed search response */
+static void
+_search_job_stream_finish(_search_job_t *job)
+{
+  gchar *next;
+  JsonObject *object;
+
+  /* write the merged result view */
+  if (job->merge)
+  {
+    object = json_object_new();
+    json_object_set_array_member(object, "results", _search_merge_results(job->merge, job->fields));
+    _search_job_stream_write(job, object);
+    json_object_unref(object);
+  }
+
+  /* write the continuation of a paged search */
+  next = _search_job_next(job);
+  if (next)
+  {
+    object = json_object_new();
+    json_object_set_string_member(object, "next", next);
+    _search_job_stream_write(job, object);
+    json_object_unref(object);
+    g_free(next);
+  }
+
+  if (job->msg)
+  {
+    g_signal_handlers_disconnect_by_data(job->msg, job);
+    soup_message_body_complete(job->msg->response_body);
+    soup_server_unpause_message(job->server, job->msg);
+    job->msg = NULL;
+  }
+
+  job->search->streams--;
+}
+
+/** replace the items of result with the requested members of them */
+static void
+_search_job_project(_search_job_t *job)
+{
+  guint i;
+  GList *members, *member;
+  JsonArray *items, *array;
+  JsonObject *result;
+
+  result = json_object_new();
+  members = json_object_get_members(job->result);
+  for (member = members; member; member = g_list_next(member))
+  {
+    items = json_object_get_array_member(job->result, member->data);
+    array = json_array_new();
+    for (i = 0; i < json_array_get_length(items); i++)
+      json_array_add_element(array, cio_response_project(json_array_get_element(items, i),
+							  job->fields));
+    json_object_set_array_member(result, member->data, array);
+  }
+  g_list_free(members);
+
+  json_object_unref(job->result);
+  job->result = result;
+}
+
+/** respond with the current search result and reset it, a finished
+    job is removed */
+static void
+_search_job_respond(_search_job_t *job, SoupServer *server, SoupMessage *msg,
+		    gboolean pretty)
+{
+  gchar *next;
+  gchar *link;
+  JsonNode *node;
+
+  job->accessed = g_get_monotonic_time();
+  job->updated = FALSE;
+
+  /* use the merged result view as result if requested */
+  if (job->merge)
+  {
+    json_object_unref(job->result);
+    job->result = json_object_new();
+    json_object_set_array_member(job->result, "results",
+				 _search_merge_results(job->merge, job->fields));
+  }
+
+  /* project the items of each provider to the requested members */
+  else if (job->fields)
+    _search_job_project(job);
+
+  /* respond with result and create new result */
+  node = json_node_alloc();
+  node = json_node_init_object(node, job->result);
+  cio_response_json(server, msg, node, pretty);
+
+  json_object_unref(job->result);
+  job->result = json_object_new();
+
+  /* if job is finished, remove, cleanup and return 200 */
+  if (job->providers == 0 || job->expired)
+  {
+    /* link the next page of a paged search */
+    next = _search_job_next(job);
+    if (next)
+    {
+      link = g_strdup_printf("<%s>; rel=\"next\"", next);
+      soup_message_headers_append(msg->response_headers, "Link", link);
+      g_free(link);
+      g_free(next);
+    }
+
+    soup_message_set_status(msg, SOUP_STATUS_OK);
+    g_hash_table_remove(job->search->jobs, job->id);
+    return;
+  }
+
+  soup_message_set_status(msg, SOUP_STATUS_PARTIAL_CONTENT);
+}
+
+static void
+_search_waiter_free(_search_waiter_t *waiter)
+{
+  waiter->job->waiters = g_list_remove(waiter->job->waiters, waiter);
 
-typedef struct _search_job_t
+  if (waiter->timeout)
+    g_source_remove(waiter->timeout);
+
+  g_signal_handlers_disconnect_by_data(waiter->msg, waiter);
+  _search_job_unref(waiter->job);
+  g_free(waiter);
+}
+
+/** answer a parked long-poll request with current search result */
+static void
+_search_waiter_respond(_search_waiter_t *waiter)
 {
+  SoupServer *server;
+  SoupMessage *msg;
 
-  gchar **types;
-  gint providers;
-  JsonObject *result;
-} _search_job_t;
+  server = waiter->server;
+  msg = waiter->msg;
 
-static _search_job_t *
-_search_job_ctor(const char *types)
+  _search_job_respond(waiter->job, server, msg, waiter->pretty);
+  _search_waiter_free(waiter);
+  soup_server_unpause_message(server, msg);
+}
+
+static gboolean
+_search_waiter_timeout(gpointer user_data)
+{
+  _search_waiter_t *waiter;
+  waiter = (_search_waiter_t *)user_data;
+
+  waiter->timeout = 0;
+  _search_waiter_respond(waiter);
+  return FALSE;
+}
+
+/** client closed the connection of a parked long-poll request */
+static void
+_search_waiter_finished(SoupMessage *msg, gpointer user_data)
+{
+  _search_waiter_free((_search_waiter_t *)user_data);
+}
+
+/** park a long-poll request until the search result is updated or
+    wait milliseconds has passed */
+static void
+_search_waiter_add(_search_job_t *job, SoupServer *server,
+		   SoupMessage *msg, gboolean pretty, guint wait)
+{
+  _search_waiter_t *waiter;
+
+  waiter = g_new0(_search_waiter_t, 1);
+  waiter->job = _search_job_ref(job);
+  waiter->server = server;
+  waiter->msg = msg;
+  waiter->pretty = pretty;
+  waiter->timeout = g_timeout_add(wait, _search_waiter_timeout, waiter);
+
+  g_signal_connect(msg, "finished", G_CALLBACK(_search_waiter_finished), waiter);
+  soup_server_pause_message(server, msg);
+
+  job->accessed = g_get_monotonic_time();
+  job->waiters = g_list_append(job->waiters, waiter);
+}
+
+static gboolean
+_search_job_wake(gpointer user_data)
 {
   _search_job_t *job;
-  job = g_new0(_search_job_t, 1);
-  job->result = json_object_new();
+  job = (_search_job_t *)user_data;
 
-  if (types)
-    job->types = g_strsplit(types, "+", -1);
+  job->wake = 0;
+  while (job->waiters)
+    _search_waiter_respond(job->waiters->data);
 
-  return job;
+  _search_job_unref(job);
+  return FALSE;
+}
+
+/** mark search result as updated and wake parked long-poll requests
+    when the current provider search has returned */
+static void
+_search_job_notify(_search_job_t *job)
+{
+  job->updated = TRUE;
+
+  if (job->waiters == NULL || job->wake != 0)
+    return;
+
+  job->wake = g_idle_add(_search_job_wake, _search_job_ref(job));
+}
+
+/** finish a search which passed its deadline with the items received
+    so far, remaining provider searches are cancelled */
+static gboolean
+_search_job_expire(gpointer user_data)
+{
+  _search_job_t *job;
+  job = (_search_job_t *)user_data;
+
+  job->timer = 0;
+  job->expired = TRUE;
+  job->cancelled = TRUE;
+
+  g_log(DOMAIN, G_LOG_LEVEL_INFO,
+	"Search deadline passed with %d provider searches pending.", job->providers);
+
+  if (job->streamed)
+    _search_job_stream_finish(job);
+  else
+    _search_job_notify(job);
+
+  return FALSE;
+}
+
+/** add keywords of a finished search which found items to the
+    search suggestions */
+static void
+_search_job_remember(_search_job_t *job)
+{
+  if (job->query && job->items > 0)
+    cio_suggest_add_query(job->search->service->suggest, job->query);
 }
 
 typedef struct _search_provider_job_t
@@ -59,6 +1131,15 @@ typedef struct _search_provider_job_t
   gchar *keywords;
   cio_provider_descriptor_t *provider;
   _search_job_t *sj;
+
+  /* requested page and number of items returned by provider */
+  gsize offset;
+  guint count;
+
+  /* search cache key and the cached or collected result */
+  gchar *key;
+  JsonArray *items;
+  gboolean cached;
 } _search_provider_job_t;
 
 
@@ -67,16 +1148,46 @@ _search_on_item_callback(cio_provider_descriptor_t *provider, JsonNode *item, gp
 {
   int keep;
   gchar **it;
+  gchar *key;
+  gboolean found;
   JsonArray *array;
   JsonObject *object;
   const gchar *item_type;
+  const gchar *uri;
   _search_job_t *job;
 
   job = (_search_job_t *)user_data;
   keep = 0;
 
   if (item == NULL)
+  {
+    /* tell streaming client that provider is finished */
+    if (job->streamed)
+    {
+      object = json_object_new();
+      json_object_set_string_member(object, "provider", provider->id);
+      json_object_set_boolean_member(object, "finished", TRUE);
+      _search_job_stream_write(job, object);
+      json_object_unref(object);
+    }
     return 1;
+  }
+
+  /* abort provider search if nobody is interested in the result */
+  if (job->cancelled)
+    return 1;
+
+  /* drop items already added from the local index */
+  if (job->indexed && JSON_NODE_HOLDS_OBJECT(item)
+      && (uri = _search_item_string(json_node_get_object(item), "uri")) != NULL)
+  {
+    key = g_strdup_printf("%s\n%s", provider->id, uri);
+    found = g_hash_table_contains(job->indexed, key);
+    g_free(key);
+
+    if (found)
+      return 0;
+  }
 
   /* verify that item is of requested type */
   if (job->types != NULL)
@@ -105,6 +1216,38 @@ _search_on_item_callback(cio_provider_descriptor_t *provider, JsonNode *item, gp
       return 0;
   }
 
+  /* abort provider search when job result limit is reached */
+  if (job->items >= job->max_items)
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_INFO,
+	  "Search result limit of %d items reached, dropping items from '%s'.",
+	  job->max_items, provider->id);
+    return 1;
+  }
+
+  job->items++;
+
+  /* merge item into best scored items */
+  if (job->merge)
+  {
+    _search_merge_add(job->merge, provider, item, job->keywords);
+    _search_job_notify(job);
+    return 0;
+  }
+
+  /* write item directly to client if streamed */
+  if (job->streamed)
+  {
+    object = json_object_new();
+    json_object_set_string_member(object, "provider", provider->id);
+    json_object_set_member(object, "item",
+			   job->fields ? cio_response_project(item, job->fields)
+			   : json_node_copy(item));
+    _search_job_stream_write(job, object);
+    json_object_unref(object);
+    return 0;
+  }
+
   /* add provide object if not exists */
   if (!json_object_has_member(job->result, provider->id))
   {
@@ -114,47 +1257,353 @@ _search_on_item_callback(cio_provider_descriptor_t *provider, JsonNode *item, gp
 
   /* add item to provider result array */
   array = json_object_get_array_member(job->result, provider->id);
-  json_array_add_element(array, item);
+  json_array_add_element(array, json_node_copy(item));
+  _search_job_notify(job);
 
   return 0;
 }
 
 static _search_provider_job_t *
 _search_provider_job_ctor(cio_provider_descriptor_t *provider,
-			  gchar *keywords, _search_job_t *job)
+			  gchar *keywords, gsize offset, _search_job_t *job,
+			  gchar *key, JsonArray *cached)
 {
   _search_provider_job_t *j;
-  j = g_malloc(sizeof(_search_provider_job_t));
-  j->provider = provider;
+  j = g_new0(_search_provider_job_t, 1);
+  j->provider = cio_provider_ref(provider);
   j->keywords = g_strdup(keywords);
-  j->sj = job;
+  j->offset = offset;
+  j->sj = _search_job_ref(job);
+  j->key = key;
+  j->cached = (cached != NULL);
+  j->items = cached ? cached : json_array_new();
+  job->search->pending++;
   return j;
 }
 
+/** check if provider can produce any of the requested types */
 static gboolean
-_search_provider_job(gpointer user_data)
+_search_provider_produces(cio_provider_descriptor_t *provider, gchar **types)
 {
-  _search_provider_job_t *job;
-  job = user_data;
-  job->provider->search(job->provider, job->keywords,
-			_search_on_item_callback, job->sj);
+  gchar **it, **pit;
+
+  if (types == NULL || provider->types == NULL)
+    return TRUE;
+
+  for (it = types; *it; it++)
+  {
+    for (pit = provider->types; *pit; pit++)
+    {
+      if (strcmp(*it, *pit) == 0)
+	return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/** pass the items of a provider search to the search job */
+static void
+_search_provider_job_replay(_search_provider_job_t *job)
+{
+  guint i;
+
+  for (i = 0; i < json_array_get_length(job->items); i++)
+  {
+    if (_search_on_item_callback(job->provider,
+				 json_array_get_element(job->items, i), job->sj) != 0)
+      break;
+  }
+  _search_on_item_callback(job->provider, NULL, job->sj);
+  job->count = json_array_get_length(job->items);
+}
+
+/** finish a provider search of the search job */
+static void
+_search_provider_job_finish(_search_provider_job_t *job)
+{
+  /* a full page means that a paged provider may have more items */
+  if (job->provider->paged && job->count >= (guint)job->sj->limit)
+    json_object_set_int_member(job->sj->next, job->provider->id,
+			       job->offset + job->count);
 
+  job->sj->search->pending--;
   job->sj->providers--;
+  if (job->sj->providers == 0)
+  {
+    if (job->sj->timer)
+      g_source_remove(job->sj->timer);
+    job->sj->timer = 0;
+
+    _search_job_remember(job->sj);
+    if (job->sj->streamed && !job->sj->expired)
+      _search_job_stream_finish(job->sj);
+    else if (!job->sj->streamed)
+      _search_job_notify(job->sj);
+  }
+
+  _search_job_unref(job->sj);
+  cio_provider_unref(job->provider);
+  json_array_unref(job->items);
   g_free(job->keywords);
+  g_free(job->key);
   g_free(job);
+}
+
+/** receive the items of a search performed on a worker thread of
+    provider */
+static void
+_search_provider_job_searched(cio_provider_descriptor_t *provider, JsonArray *items,
+			      gint64 elapsed, gpointer user_data)
+{
+  guint i;
+  JsonNode *item;
+  _search_provider_job_t *job;
+
+  job = (_search_provider_job_t *)user_data;
+
+  if (cio_provider_stats_record(&provider->stats, elapsed, items != NULL))
+    g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	  "Provider '%s' failed repeatedly, searches are short-circuited.",
+	  provider->id);
+
+  if (items)
+  {
+    json_array_unref(job->items);
+    job->items = json_array_ref(items);
+
+    /* add all items seen to the index and suggestions */
+    for (i = 0; i < json_array_get_length(items); i++)
+    {
+      item = json_array_get_element(items, i);
+      cio_index_add(job->sj->search->service->index, provider->id, item);
+      cio_suggest_add_item(job->sj->search->service->suggest, item);
+    }
+
+    _search_cache_store(job->sj->search, job->key, items);
+  }
+
+  if (!job->sj->cancelled)
+    _search_provider_job_replay(job);
+
+  _search_provider_job_finish(job);
+}
+
+static gboolean
+_search_provider_job(gpointer user_data)
+{
+  _search_provider_job_t *job;
+  job = user_data;
+
+  /* replay cached provider result */
+  if (job->cached && !job->sj->cancelled)
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_DEBUG,
+	  "Using cached search result from provider '%s'.", job->provider->id);
+    _search_provider_job_replay(job);
+  }
+
+  /* perform search on the worker threads of provider, never on the
+     main loop */
+  else if (!job->sj->cancelled)
+  {
+    cio_provider_search_queue(job->provider, job->keywords, job->sj->types,
+			      job->offset, job->sj->limit,
+			      _search_provider_job_searched, job);
+    return FALSE;
+  }
+
+  _search_provider_job_finish(job);
   return FALSE;
 }
 
+/** check if provider is enabled and in the providers list of query */
+static gboolean
+_search_provider_wanted(cio_service_t *service, cio_provider_descriptor_t *provider,
+			const gchar *providers)
+{
+  GError *err;
+  gboolean enabled;
+
+  /* continue with next if provider is disabled */
+  err = NULL;
+  enabled = cio_settings_get_boolean_value(service->settings,
+					   provider->id, "enabled", &err);
+  if (err == NULL && enabled == FALSE)
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_INFO,
+	  "Provider '%s' is disabled.", provider->id);
+    return FALSE;
+  }
+  g_clear_error(&err);
+
+  /* lookup provider in specified providers list from query */
+  if (providers && g_strrstr(providers, provider->id) == NULL)
+    return FALSE;
+
+  return TRUE;
+}
+
+/** add items matching the search from the local index to job */
+static void
+_search_job_add_indexed(_search_job_t *job, cio_service_t *service,
+			const gchar *providers)
+{
+  guint i;
+  gchar *key;
+  const gchar *uri;
+  JsonNode *item;
+  JsonArray *hits;
+  JsonObject *hit;
+  cio_provider_descriptor_t *provider;
+
+  hits = cio_index_search(service->index, job->keywords, job->types, job->limit);
+  for (i = 0; i < json_array_get_length(hits); i++)
+  {
+    hit = json_array_get_object_element(hits, i);
+    provider = g_hash_table_lookup(service->providers,
+				   json_object_get_string_member(hit, "provider"));
+    if (provider == NULL || !_search_provider_wanted(service, provider, providers))
+      continue;
+
+    /* an item without uri can not be told apart from provider items */
+    item = json_object_get_member(hit, "item");
+    if (!JSON_NODE_HOLDS_OBJECT(item)
+	|| (uri = _search_item_string(json_node_get_object(item), "uri")) == NULL)
+      continue;
+
+    if (_search_on_item_callback(provider, item, job) != 0)
+      break;
+
+    key = g_strdup_printf("%s\n%s", provider->id, uri);
+    g_hash_table_add(job->indexed, key);
+  }
+
+  g_log(DOMAIN, G_LOG_LEVEL_DEBUG,
+	"Added %d items from local index to search.", g_hash_table_size(job->indexed));
+
+  json_array_unref(hits);
+}
+
+/** remove jobs which results has not been fetched within job ttl */
+static gboolean
+_search_reaper(gpointer user_data)
+{
+  gint64 ttl, now;
+  gpointer key, value;
+  GHashTableIter iter;
+  cio_search_t *self;
+  _search_job_t *job;
+
+  self = (cio_search_t *)user_data;
+
+  ttl = (gint64)_search_setting(self, "job_ttl", 300) * G_USEC_PER_SEC;
+  now = g_get_monotonic_time();
+
+  g_hash_table_iter_init(&iter, self->jobs);
+  while (g_hash_table_iter_next(&iter, &key, &value))
+  {
+    job = (_search_job_t *)value;
+    if (now - job->accessed < ttl)
+      continue;
+
+    g_log(DOMAIN, G_LOG_LEVEL_INFO,
+	  "Removing abandoned search job '%s'.", (gchar *)key);
+
+    job->cancelled = TRUE;
+    g_hash_table_iter_remove(&iter);
+  }
+
+  _search_cache_expire(self);
+
+  return TRUE;
+}
+
+/** setup default values for search settings */
+static void
+_search_configuration_defaults(cio_service_t *service)
+{
+  JsonNode *value;
+
+  value = json_node_init_int(json_node_alloc(), 300);
+  cio_settings_create_value(service->settings, "search", "job_ttl",
+			    "Search result lifetime",
+			    "Seconds a search result is kept when not fetched by a client.",
+			    value, NULL);
+  json_node_free(value);
+
+  value = json_node_init_int(json_node_alloc(), 32);
+  cio_settings_create_value(service->settings, "search", "max_jobs",
+			    "Maximum searches",
+			    "Maximum number of concurrent searches, further searches are"
+			    " rejected until the running ones are finished.",
+			    value, NULL);
+  json_node_free(value);
+
+  value = json_node_init_int(json_node_alloc(), 128);
+  cio_settings_create_value(service->settings, "search", "max_queued",
+			    "Maximum queued provider searches",
+			    "Maximum number of provider searches waiting to be performed.",
+			    value, NULL);
+  json_node_free(value);
+
+  value = json_node_init_int(json_node_alloc(), 500);
+  cio_settings_create_value(service->settings, "search", "max_items",
+			    "Maximum items per search",
+			    "Maximum number of items collected for one search.",
+			    value, NULL);
+  json_node_free(value);
+
+  value = json_node_init_int(json_node_alloc(), 10);
+  cio_settings_create_value(service->settings, "search", "limit",
+			    "Search limit",
+			    "Number of items requested from each provider when a search"
+			    " does not specify a limit.",
+			    value, NULL);
+  json_node_free(value);
+
+  value = json_node_init_int(json_node_alloc(), 15);
+  cio_settings_create_value(service->settings, "search", "timeout",
+			    "Search timeout",
+			    "Seconds before a search is finished with the items received"
+			    " so far, 0 waits for all providers.",
+			    value, NULL);
+  json_node_free(value);
+
+  value = json_node_init_int(json_node_alloc(), 600);
+  cio_settings_create_value(service->settings, "search", "cache_ttl",
+			    "Search cache lifetime",
+			    "Seconds a provider search result is reused for identical"
+			    " searches, 0 disables the search cache.",
+			    value, NULL);
+  json_node_free(value);
+
+  value = json_node_init_int(json_node_alloc(), 256);
+  cio_settings_create_value(service->settings, "search", "cache_size",
+			    "Search cache size",
+			    "Maximum number of provider search results kept in cache.",
+			    value, NULL);
+  json_node_free(value);
+}
+
 cio_search_t *
-cio_search_new()
+cio_search_new(cio_service_t *service)
 {
   cio_search_t *search;
 
   search = g_malloc(sizeof(cio_search_t));
   memset(search, 0, sizeof(cio_search_t));
 
+  search->service = service;
   search->jobs = g_hash_table_new_full(g_str_hash, g_str_equal,
-				       g_free, NULL);
+				       g_free, (GDestroyNotify)_search_job_unref);
+  search->cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+					g_free, (GDestroyNotify)_search_cache_entry_free);
+
+  _search_configuration_defaults(service);
+
+  search->reaper = g_timeout_add_seconds(SEARCH_REAPER_INTERVAL,
+					 _search_reaper, search);
 
   return search;
 }
@@ -162,7 +1611,9 @@ cio_search_new()
 void
 cio_search_destroy(cio_search_t *self)
 {
+  g_source_remove(self->reaper);
   g_hash_table_destroy(self->jobs);
+  g_hash_table_destroy(self->cache);
   g_free(self);
 }
 
@@ -172,41 +1623,53 @@ cio_search_request_handler(SoupServer *server, SoupMessage *msg,
 			   SoupClientContext *client, gpointer user_data)
 {
   gsize vlen;
-  gchar *content;
-  gsize length;
   gchar **components;
   cio_service_t *service;
   _search_job_t *job;
-  GList *iter;
+  GList *iter, *keys;
   gchar *keywords;
   gchar *types;
   gchar *providers;
-  gchar *key;
+  gchar *stream;
+  gchar *top;
+  gchar *mode;
+  gchar *value;
+  gint64 wait;
+  gint timeout;
+  gint64 limit;
+  gint64 offset;
+  gchar *nkeywords;
+  gchar *ntypes;
+  gchar **wanted;
+  gchar **fields;
+  gchar *ckey;
+  const gchar *accept;
   gchar location[512];
-  JsonGenerator *gen;
-  JsonNode *node;
-  GError *err;
-  gboolean enabled;
+  gboolean indexonly, firstpage;
   cio_provider_descriptor_t *provider;
+  _search_cursor_t *cursor;
 
   job = NULL;
-  err = NULL;
+  cursor = NULL;
+  keys = NULL;
+  wanted = NULL;
+  nkeywords = ntypes = NULL;
   service = (cio_service_t *)user_data;
 
-  /* we will only handle /settings and /settings/<jobid> paths */
+  /* we will only handle /search and /search/<jobid> paths */
   components = g_strsplit(path, "/", -1);
   vlen = g_strv_length(components);
   if (vlen != 2 && vlen != 3)
   {
     soup_message_set_status(msg, SOUP_STATUS_NOT_FOUND);
-    return;
+    goto finished;
   }
 
   /* this handler only supports GET methods */
   if (msg->method != SOUP_METHOD_GET)
   {
     soup_message_set_status(msg, SOUP_STATUS_METHOD_NOT_ALLOWED);
-    return;
+    goto finished;
   }
 
   /*
@@ -220,65 +1683,143 @@ cio_search_request_handler(SoupServer *server, SoupMessage *msg,
       soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
       g_log(DOMAIN, G_LOG_LEVEL_WARNING,
 	    "Search failed, no query specified in the request.");
-      return;
+      goto finished;
+    }
+
+    /* continue a paged search from the cursor */
+    value = g_hash_table_lookup(query, "cursor");
+    if (value)
+    {
+      cursor = _search_cursor_decode(value);
+      if (cursor == NULL)
+      {
+	soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+	g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	      "Search failed, invalid cursor specified in the request.");
+	goto finished;
+      }
     }
 
-    keywords = g_hash_table_lookup(query, "keywords");
+    if (cursor)
+      keywords = (gchar *)cursor->keywords;
+    else
+      keywords = g_hash_table_lookup(query, "keywords");
+
     if (keywords == NULL)
     {
       soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
       g_log(DOMAIN, G_LOG_LEVEL_WARNING,
 	    "Search failed, no keywords specified in the request.");
-      return;
+      goto finished;
     }
 
+    /* reject search if service is busy */
+    if ((gint)g_hash_table_size(service->search->jobs) + service->search->streams
+	>= _search_setting(service->search, "max_jobs", 32)
+	|| service->search->pending >= _search_setting(service->search, "max_queued", 128))
+    {
+      g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	    "Search rejected, too many concurrent searches.");
+      soup_message_headers_replace(msg->response_headers, "Retry-After", "5");
+      soup_message_set_status(msg, SOUP_STATUS_SERVICE_UNAVAILABLE);
+      goto finished;
+    }
 
     /* verify that service has registered providers */
-    iter = g_hash_table_get_keys(service->providers);
+    keys = iter = g_hash_table_get_keys(service->providers);
     if (iter == NULL)
     {
       soup_message_set_status(msg, SOUP_STATUS_SERVICE_UNAVAILABLE);
       g_log(DOMAIN, G_LOG_LEVEL_WARNING,
 	    "Search failed, no providers registered with the service.");
-      return;
+      goto finished;
     }
 
     providers = g_hash_table_lookup(query, "providers");
-    types = g_hash_table_lookup(query, "types");
+    types = cursor ? (gchar *)cursor->types : g_hash_table_lookup(query, "types");
+    stream = g_hash_table_lookup(query, "stream");
+    top = g_hash_table_lookup(query, "top");
+    mode = g_hash_table_lookup(query, "index");
 
-    do
+    /* get page size and offset of search */
+    limit = _search_setting(service->search, "limit", 10);
+    value = g_hash_table_lookup(query, "limit");
+    if (cursor)
+      limit = cursor->limit;
+    else if (value)
+      limit = g_ascii_strtoll(value, NULL, 10);
+    limit = CLAMP(limit, 1, _search_setting(service->search, "max_items", 500));
+
+    offset = 0;
+    value = g_hash_table_lookup(query, "offset");
+    if (value)
+      offset = MAX(g_ascii_strtoll(value, NULL, 10), 0);
+
+    nkeywords = _search_normalize(keywords);
+    ntypes = _search_normalize(types);
+    if (*ntypes != '\0')
+      wanted = g_strsplit(ntypes, "+", -1);
+
+    /* search the local index only or blend it with provider results,
+       the index has no pages and only adds items to the first page */
+    indexonly = (g_strcmp0(mode, "only") == 0);
+    firstpage = (cursor == NULL && offset == 0);
+    if (indexonly || (firstpage && g_strcmp0(mode, "blend") == 0))
+    {
+      job = _search_job_ctor(service->search, nkeywords, wanted ? ntypes : NULL,
+			     top ? g_ascii_strtoll(top, NULL, 10) : 0, limit);
+      if (firstpage)
+	job->indexed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+
+    for (iter = indexonly ? NULL : keys; iter; iter = g_list_next(iter))
     {
       provider = g_hash_table_lookup(service->providers, iter->data);
 
       if (provider->search == NULL)
 	continue;
 
-      /* continue with next if provider is disabled */
-      g_clear_error(&err);
-      enabled = cio_settings_get_boolean_value(service->settings,
-					       provider->id, "enabled", &err);
-      if (err == NULL && enabled == FALSE)
+      if (!_search_provider_wanted(service, provider, providers))
+	continue;
+
+      /* skip provider while it is failing repeatedly */
+      if (!cio_provider_stats_allow(&provider->stats))
       {
 	g_log(DOMAIN, G_LOG_LEVEL_INFO,
-	      "Provider '%s' is disabled.", provider->id);
+	      "Provider '%s' is unavailable, search short-circuited.", provider->id);
 	continue;
       }
 
-
-      /* lookup provider in specified providers list from query */
-      if (providers && g_strrstr(providers, provider->id) == NULL)
+      /* skip provider that can not produce any of requested types */
+      if (!_search_provider_produces(provider, wanted))
+      {
+	g_log(DOMAIN, G_LOG_LEVEL_DEBUG,
+	      "Provider '%s' do not produce any of requested types.", provider->id);
 	continue;
+      }
+
+      /* a cursor continues only providers with more items */
+      if (cursor)
+      {
+	if (!json_object_has_member(cursor->offsets, provider->id))
+	  continue;
+	offset = MAX(json_object_get_int_member(cursor->offsets, provider->id), 0);
+      }
 
       if (job == NULL)
-	job = _search_job_ctor(types);
+	job = _search_job_ctor(service->search, nkeywords, wanted ? ntypes : NULL,
+			       top ? g_ascii_strtoll(top, NULL, 10) : 0, limit);
 
       job->providers++;
 
-      /* create a job for each search on main thread */
+      /* create a job for each search on main thread, reusing a
+	 cached result from an identical search if available */
+      ckey = g_strdup_printf("%s\n%s\n%s\n%" G_GINT64_FORMAT "\n%" G_GINT64_FORMAT,
+			     provider->id, nkeywords, ntypes, offset, limit);
       g_idle_add(_search_provider_job,
-		 _search_provider_job_ctor(provider, keywords, job));
-
-    } while((iter = g_list_next(iter)) != NULL);
+		 _search_provider_job_ctor(provider, keywords, offset, job, ckey,
+					   _search_cache_lookup(service->search, ckey)));
+    }
 
     /* verify that we actually have a search job */
     if (job == NULL)
@@ -286,20 +1827,82 @@ cio_search_request_handler(SoupServer *server, SoupMessage *msg,
       g_log(DOMAIN, G_LOG_LEVEL_WARNING,
 	    "Search failed, no matching providers specified in query.");
       soup_message_set_status(msg, SOUP_STATUS_SERVICE_UNAVAILABLE);
-      return;
+      goto finished;
+    }
+
+    /* keep keywords of a new search for suggestions */
+    if (cursor == NULL)
+      job->query = g_strdelimit(g_strdup(keywords), "+", ' ');
+
+    job->fields = cio_response_fields(query);
+
+    /* finish search with the items received so far at the deadline */
+    timeout = _search_setting(service->search, "timeout", 15);
+    if (job->providers > 0 && timeout > 0)
+      job->timer = g_timeout_add_seconds_full(G_PRIORITY_DEFAULT, timeout,
+					      _search_job_expire,
+					      _search_job_ref(job),
+					      (GDestroyNotify)_search_job_unref);
+
+    /* stream the result in the response instead of redirecting */
+    if (stream && g_strcmp0(stream, "0") != 0)
+    {
+      accept = soup_message_headers_get_one(msg->request_headers, "Accept");
+
+      job->streamed = TRUE;
+      job->sse = (g_strcmp0(stream, "sse") == 0
+		  || (accept && g_strrstr(accept, "text/event-stream")));
+      job->server = server;
+      job->msg = msg;
+      service->search->streams++;
+
+      g_signal_connect(msg, "finished",
+		       G_CALLBACK(_search_job_stream_finished), job);
+
+      soup_message_headers_set_encoding(msg->response_headers, SOUP_ENCODING_CHUNKED);
+      soup_message_headers_set_content_type(msg->response_headers,
+					    job->sse
+					    ? "text/event-stream; charset=utf-8"
+					    : "application/x-ndjson; charset=utf-8",
+					    NULL);
+      soup_message_body_set_accumulate(msg->response_body, FALSE);
+      soup_message_set_status(msg, SOUP_STATUS_OK);
+
+      if (job->indexed)
+	_search_job_add_indexed(job, service, providers);
+
+      if (job->providers == 0)
+      {
+	_search_job_remember(job);
+	_search_job_stream_finish(job);
+      }
+
+      /* provider jobs holds the references of a streamed job */
+      _search_job_unref(job);
+      goto finished;
+    }
+
+    if (job->indexed)
+      _search_job_add_indexed(job, service, providers);
+
+    /* answer a search of the local index only directly */
+    if (job->providers == 0)
+    {
+      _search_job_remember(job);
+      _search_job_respond(job, server, msg, cio_response_pretty(query));
+      _search_job_unref(job);
+      goto finished;
     }
 
     /* add job to hash table */
-    g_snprintf(location, sizeof(location), "%x", g_int64_hash(job));
-    g_snprintf(location, sizeof(location), "%x", g_str_hash(location));
-    key = g_strdup(location);
-    g_hash_table_insert(service->search->jobs, key, job);
+    _search_job_id(job->id, sizeof(job->id));
+    g_hash_table_insert(service->search->jobs, g_strdup(job->id), job);
 
     /* build a result uri and add location header to response */
-    g_snprintf(location, sizeof(location), "/search/%s", key);
+    g_snprintf(location, sizeof(location), "/search/%s", job->id);
     soup_message_headers_append(msg->response_headers, "Location", location);
     soup_message_set_status(msg, SOUP_STATUS_MOVED_TEMPORARILY);
-    return;
+    goto finished;
   }
 
   /*
@@ -313,44 +1916,37 @@ cio_search_request_handler(SoupServer *server, SoupMessage *msg,
     {
       g_log(DOMAIN, G_LOG_LEVEL_WARNING, "No search result available for '%s'", path);
       soup_message_set_status(msg, SOUP_STATUS_NOT_FOUND);
-      return;
+      goto finished;
     }
 
-    /* generate json from result as content */
-    node = json_node_alloc();
-    node = json_node_init_object(node, job->result);
-
-    gen = json_generator_new();
-    json_generator_set_pretty(gen, TRUE);
-    json_generator_set_root(gen, node);
-    content = json_generator_to_data(gen, &length);
-    g_object_unref(gen);
-
-    soup_message_set_response(msg,
-			      "application/json; charset=utf-8",
-			      SOUP_MEMORY_TAKE,
-			      content,
-			      length);
-
-
-    /* free result and create new array */
-    json_node_free(node);
-    job->result = json_object_new();
+    /* members of items requested when getting the result */
+    if ((fields = cio_response_fields(query)) != NULL)
+    {
+      g_strfreev(job->fields);
+      job->fields = fields;
+    }
 
-    /* if job is finished, remove, cleanup and return 200 */
-    if (job->providers == 0)
+    /* park request until result is updated if client waits */
+    value = query ? g_hash_table_lookup(query, "wait") : NULL;
+    wait = value ? CLAMP(g_ascii_strtoll(value, NULL, 10), 0, SEARCH_MAX_WAIT) : 0;
+    if (wait > 0 && !job->updated && job->providers > 0 && !job->expired)
     {
-      g_hash_table_remove(service->search->jobs, components[2]);
-      if (job->types)
-	g_strfreev(job->types);
-      g_free(job);
-      soup_message_set_status(msg, SOUP_STATUS_OK);
-      return;
+      _search_waiter_add(job, server, msg, cio_response_pretty(query), wait);
+      goto finished;
     }
 
-    soup_message_set_status(msg, SOUP_STATUS_PARTIAL_CONTENT);
-    return;
+    _search_job_respond(job, server, msg, cio_response_pretty(query));
+    goto finished;
   }
 
   soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
+
+finished:
+  if (cursor)
+    _search_cursor_free(cursor);
+  g_free(nkeywords);
+  g_free(ntypes);
+  g_strfreev(wanted);
+  g_list_free(keys);
+  g_strfreev(components);
 }
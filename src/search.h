@@ -25,8 +25,9 @@
 #include <libsoup/soup.h>
 
 struct cio_search_t;
+struct cio_service_t;
 
-struct cio_search_t *cio_search_new();
+struct cio_search_t *cio_search_new(struct cio_service_t *service);
 
 void cio_search_destroy(struct cio_search_t *self);
 
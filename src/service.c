@@ -24,11 +24,16 @@
 #include <errno.h>
 #include <sys/time.h>
 #include <glib.h>
+#include <gio/gio.h>
 
 #include "config.h"
+#include "batch.h"
 #include "blobcache.h"
+#include "index.h"
+#include "response.h"
 #include "service.h"
 #include "search.h"
+#include "suggest.h"
 #include "settings.h"
 #include "provider.h"
 
@@ -51,8 +56,36 @@ typedef struct cio_service_priv_t
   SoupServer *server;
   SoupAuthDomain *domain;
   GQueue *backlog;
+
+  /* messages are logged from provider worker threads */
+  GMutex backlog_lock;
+
+  /* plugins loaded in the background and the number of plugins of
+     startup not yet loaded */
+  GThreadPool *loader;
+  guint loading;
+
+  /* loads not yet added on the main loop and the latest load of each
+     plugin file, an older load finished later is dropped */
+  GList *loads;
+  GHashTable *generations;
+
+  /* added or updated plugins of plugin directory are reloaded */
+  GFileMonitor *monitor;
 } cio_service_priv_t;
 
+/* a plugin loaded on a loader thread */
+typedef struct _service_plugin_load_t
+{
+  cio_service_t *service;
+  gchar *filename;
+  cio_provider_descriptor_t *provider;
+
+  /* replace an already loaded provider of same id */
+  gboolean reload;
+  guint generation;
+} _service_plugin_load_t;
+
 static JsonNode *
 _service_log_entry(const char *timestamp,
 		   const gchar *log_domain,
@@ -108,11 +141,13 @@ _service_log_handler(const gchar *log_domain,
   g_snprintf(timestamp, sizeof(timestamp), "%d.%d", (int)tv.tv_sec, (int)tv.tv_usec);
 
   /* add log entry to backlog, pop head item if full */
+  g_mutex_lock(&service->priv->backlog_lock);
   g_queue_push_tail(service->priv->backlog,
 		    _service_log_entry(timestamp, log_domain, log_level, message));
 
   if (g_queue_get_length(service->priv->backlog) >= 100)
     json_node_free(g_queue_pop_head(service->priv->backlog));
+  g_mutex_unlock(&service->priv->backlog_lock);
 
   /* print the log message */
   if (log_level & (G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL
@@ -180,15 +215,150 @@ _service_configuration_defaults(cio_service_t *self)
   json_node_free(value);
 }
 
-/** Initialize providers internal and plugins */
+/** register handler for the web api of provider */
+static void
+_service_provider_handler(cio_service_t *self, cio_provider_descriptor_t *provider)
+{
+  gchar path[512];
+
+  g_snprintf(path, sizeof(path), "/providers/%s", provider->id);
+  soup_server_add_handler(self->priv->server, path,
+			  cio_provider_request_handler,
+			  self, NULL);
+}
+
+/** add a loaded plugin provider on the main loop */
+static gboolean
+_service_plugin_loaded(gpointer user_data)
+{
+  cio_service_t *self;
+  _service_plugin_load_t *load;
+
+  load = (_service_plugin_load_t *)user_data;
+  self = load->service;
+  self->priv->loads = g_list_remove(self->priv->loads, load);
+
+  if (load->provider
+      && load->generation != GPOINTER_TO_UINT(g_hash_table_lookup(self->priv->generations,
+								 load->filename)))
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_DEBUG,
+	  "Dropping outdated load of '%s'.", load->filename);
+    cio_provider_unref(load->provider);
+  }
+  else if (load->provider && g_hash_table_lookup(self->providers, load->provider->id))
+  {
+    if (load->reload)
+    {
+      /* requests in flight keep the replaced provider until done */
+      g_log(DOMAIN, G_LOG_LEVEL_INFO,
+	    "Provider '%s' reloaded from '%s'.", load->provider->id, load->filename);
+      g_hash_table_replace(self->providers, load->provider->id, load->provider);
+    }
+    else
+    {
+      g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	    "Provider '%s' of '%s' is already loaded.", load->provider->id, load->filename);
+      cio_provider_unref(load->provider);
+    }
+  }
+  else if (load->provider)
+  {
+    g_hash_table_insert(self->providers, load->provider->id, load->provider);
+    cio_suggest_add_provider(self->suggest, load->provider);
+    _service_provider_handler(self, load->provider);
+  }
+
+  if (!load->reload && --self->priv->loading == 0)
+    g_log(DOMAIN, G_LOG_LEVEL_INFO, "All provider plugins are loaded.");
+
+  g_free(load->filename);
+  g_free(load);
+  return FALSE;
+}
+
+/** load and instantiate a plugin on a loader thread */
+static void
+_service_plugin_load(gpointer data, gpointer user_data)
+{
+  _service_plugin_load_t *load;
+
+  load = (_service_plugin_load_t *)data;
+  load->provider = cio_provider_instance(load->service,
+					 CIO_PROVIDER_JAVASCRIPT_PLUGIN, load->filename);
+  g_idle_add(_service_plugin_loaded, load);
+}
+
+/** queue load of plugin filename on the loader threads */
+static void
+_service_plugin_queue(cio_service_t *self, const gchar *filename, gboolean reload)
+{
+  guint generation;
+  GFile *file;
+  _service_plugin_load_t *load;
+
+  load = g_new0(_service_plugin_load_t, 1);
+  load->service = self;
+  load->reload = reload;
+
+  /* same name of file whether found at startup or by the monitor */
+  file = g_file_new_for_path(filename);
+  load->filename = g_file_get_path(file);
+  g_object_unref(file);
+
+  generation = GPOINTER_TO_UINT(g_hash_table_lookup(self->priv->generations,
+						     load->filename));
+  load->generation = generation + 1;
+  g_hash_table_replace(self->priv->generations, g_strdup(load->filename),
+		       GUINT_TO_POINTER(load->generation));
+
+  if (!reload)
+    self->priv->loading++;
+
+  self->priv->loads = g_list_prepend(self->priv->loads, load);
+  g_thread_pool_push(self->priv->loader, load, NULL);
+}
+
+/** reload a plugin when it is written or moved into plugin directory */
+static void
+_service_plugin_dir_changed(GFileMonitor *monitor, GFile *file, GFile *other,
+			    GFileMonitorEvent event, gpointer user_data)
+{
+  gchar *filename;
+  cio_service_t *self;
+
+  self = (cio_service_t *)user_data;
+
+  /* a renamed file is loaded by its new name */
+  if (event == G_FILE_MONITOR_EVENT_RENAMED && other)
+    file = other;
+  else if (event != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT
+	   && event != G_FILE_MONITOR_EVENT_MOVED_IN)
+    return;
+
+  filename = g_file_get_path(file);
+  if (filename && g_str_has_suffix(filename, ".zip")
+      && g_file_test(filename, G_FILE_TEST_IS_REGULAR))
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_INFO,
+	  "Plugin '%s' changed, loading it.", filename);
+    _service_plugin_queue(self, filename, TRUE);
+  }
+
+  g_free(filename);
+}
+
+/** Initialize providers internal and plugins, the plugins are loaded
+    in the background and added when ready */
 static void
 _service_initialize_providers(cio_service_t *self)
 {
   GError *err;
   const gchar *filename;
   gchar *plugindir;
-  gchar plugin[4096];
+  gchar *path;
   GDir *dir;
+  GFile *file;
   cio_provider_descriptor_t *provider;
 
   err = NULL;
@@ -224,6 +394,10 @@ _service_initialize_providers(cio_service_t *self)
     return;
   }
 
+  self->priv->loader = g_thread_pool_new(_service_plugin_load, NULL,
+					 MAX(g_get_num_processors(), 2),
+					 FALSE, NULL);
+
   while ((filename = g_dir_read_name(dir)) != NULL)
   {
     if (g_strcmp0(filename, ".") == 0 || g_strcmp0(filename, "..") == 0)
@@ -232,33 +406,45 @@ _service_initialize_providers(cio_service_t *self)
     if (g_strcmp0(filename + strlen(filename) - 4, ".zip") != 0)
       continue;
 
-    g_snprintf(plugin, sizeof(plugin), "%s/%s", plugindir, filename);
-    provider = cio_provider_instance(self, CIO_PROVIDER_JAVASCRIPT_PLUGIN, plugin);
-    if (provider == NULL)
-      continue;
-
-    g_hash_table_insert(self->providers, provider->id, provider);
+    path = g_strdup_printf("%s/%s", plugindir, filename);
+    _service_plugin_queue(self, path, FALSE);
+    g_free(path);
   }
 
   g_dir_close(dir);
+
+  /* watch plugin directory for added and updated plugins */
+  file = g_file_new_for_path(plugindir);
+  self->priv->monitor = g_file_monitor_directory(file, G_FILE_MONITOR_WATCH_MOVES,
+						 NULL, &err);
+  g_object_unref(file);
+  if (self->priv->monitor == NULL)
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	  "Failed to watch plugin directory: %s", err->message);
+    g_clear_error(&err);
+  }
+  else
+    g_signal_connect(self->priv->monitor, "changed",
+		     G_CALLBACK(_service_plugin_dir_changed), self);
+
   g_free(plugindir);
 }
 
 /** create json array of backlog */
-static gchar *
-_service_backlog_to_json(cio_service_t *self, gsize *length)
+static JsonNode *
+_service_backlog_to_json(cio_service_t *self)
 {
   int i, len;
-  gchar *content;
   JsonNode *node;
   JsonNode *item;
   JsonArray *array;
-  JsonGenerator *gen;
 
   node = json_node_alloc();
   array = json_array_new();
   json_node_init_array(node, array);
 
+  g_mutex_lock(&self->priv->backlog_lock);
   len = g_queue_get_length(self->priv->backlog);
 
   for (i = 0; i < len; i++)
@@ -270,28 +456,22 @@ _service_backlog_to_json(cio_service_t *self, gsize *length)
 
     json_array_add_element(array, json_node_copy(item));
   }
+  g_mutex_unlock(&self->priv->backlog_lock);
 
-  /* stringify json node */
-  gen = json_generator_new();
-  json_generator_set_pretty(gen, TRUE);
-  json_generator_set_root(gen, node);
-  content = json_generator_to_data(gen, length);
-  json_node_free(node);
-  g_object_unref(gen);
-  return content;
+  json_array_unref(array);
+  return node;
 }
 
 /** create json array of available providers */
-static gchar *
-_service_providers_to_json(cio_service_t *self, gsize *length, gsize offset, gsize limit)
+static JsonNode *
+_service_providers_to_json(cio_service_t *self, gsize offset, gsize limit)
 {
   cio_provider_descriptor_t *provider;
-  JsonGenerator *gen;
   JsonBuilder *builder;
   JsonNode *root;
   GList *item;
-  gchar *content;
   gsize cnt;
+  gint64 p95;
 
   item = g_hash_table_get_values(self->providers);
 
@@ -339,21 +519,35 @@ _service_providers_to_json(cio_service_t *self, gsize *length, gsize offset, gsi
     builder = json_builder_set_member_name(builder, "icon");
     builder= json_builder_add_string_value(builder, provider->icon);
 
+    /* add latency and availability of provider */
+    builder = json_builder_set_member_name(builder, "latency");
+    builder = json_builder_add_int_value(builder, provider->stats.ewma / 1000);
+    builder = json_builder_set_member_name(builder, "p95");
+    p95 = cio_provider_stats_percentile(&provider->stats, 95);
+    builder = json_builder_add_int_value(builder, p95 < 0 ? -1 : p95 / 1000);
+    builder = json_builder_set_member_name(builder, "failures");
+    builder = json_builder_add_int_value(builder, provider->stats.failures);
+    builder = json_builder_set_member_name(builder, "available");
+    builder = json_builder_add_boolean_value(builder,
+					     provider->stats.open_until <= g_get_monotonic_time());
+
+    /* add memory used by the scripts of provider */
+    g_mutex_lock(&provider->lock);
+    builder = json_builder_set_member_name(builder, "memory");
+    builder = json_builder_add_int_value(builder, provider->memory);
+    builder = json_builder_set_member_name(builder, "memory_peak");
+    builder = json_builder_add_int_value(builder, provider->memory_peak);
+    g_mutex_unlock(&provider->lock);
+
     builder = json_builder_end_object(builder);
     item = g_list_next(item);
     cnt++;
   }
   builder = json_builder_end_array(builder);
 
-  /* convert json object to text representation */
-  gen = json_generator_new();
   root = json_builder_get_root(builder);
-  json_generator_set_pretty(gen, TRUE);
-  json_generator_set_root(gen, root);
-  content = json_generator_to_data(gen, length);
-  json_node_free(root);
   g_object_unref(builder);
-  return content;
+  return root;
 }
 
 /** handler for /providers api request */
@@ -362,8 +556,7 @@ _service_providers_request_handler(SoupServer *server, SoupMessage *msg, const c
 				   GHashTable *query, SoupClientContext *client, gpointer user_data)
 {
   cio_service_t *service;
-  gsize length;
-  char *content;
+  JsonNode *root;
 
   service = (cio_service_t *)user_data;
 
@@ -375,6 +568,14 @@ _service_providers_request_handler(SoupServer *server, SoupMessage *msg, const c
 
   if (g_strcmp0(path, "/providers") != 0)
   {
+    /* provider may be a plugin which is not yet loaded */
+    if (service->priv->loading > 0)
+    {
+      soup_message_headers_append(msg->response_headers, "Retry-After", "5");
+      soup_message_set_status(msg, SOUP_STATUS_SERVICE_UNAVAILABLE);
+      return;
+    }
+
     soup_message_set_status(msg, SOUP_STATUS_NOT_FOUND);
     return;
   }
@@ -395,12 +596,8 @@ _service_providers_request_handler(SoupServer *server, SoupMessage *msg, const c
 
   }
 
-  content = _service_providers_to_json(service, &length, offset, limit);
-  soup_message_set_response(msg,
-			    "application/json; charset=utf-8",
-			    SOUP_MEMORY_TAKE,
-			    content,
-			    length);
+  root = _service_providers_to_json(service, offset, limit);
+  cio_response_json(server, msg, root, cio_response_pretty(query));
 
   soup_message_set_status(msg, 200);
 }
@@ -411,8 +608,7 @@ _service_backlog_request_handler(SoupServer *server, SoupMessage *msg, const cha
 				 GHashTable *query, SoupClientContext *client, gpointer user_data)
 {
   cio_service_t *service;
-  gsize length;
-  char *content;
+  JsonNode *root;
 
   service = (cio_service_t *)user_data;
 
@@ -428,12 +624,8 @@ _service_backlog_request_handler(SoupServer *server, SoupMessage *msg, const cha
     return;
   }
 
-  content = _service_backlog_to_json(service, &length);
-  soup_message_set_response(msg,
-			    "application/json; charset=utf-8",
-			    SOUP_MEMORY_TAKE,
-			    content,
-			    length);
+  root = _service_backlog_to_json(service);
+  cio_response_json(server, msg, root, cio_response_pretty(query));
 
   soup_message_set_status(msg, 200);
 }
@@ -592,7 +784,6 @@ _service_initialize_handler(cio_service_t *self)
 {
   GList *list, *item;
   cio_provider_descriptor_t *provider;
-  gchar path[512];
 
   /* add handler for backlog */
   soup_server_add_handler(self->priv->server, "/backlog",
@@ -609,6 +800,16 @@ _service_initialize_handler(cio_service_t *self)
 			  cio_search_request_handler,
 			  self, NULL);
 
+  /* add handler for search suggestions */
+  soup_server_add_handler(self->priv->server, "/suggest",
+			  cio_suggest_request_handler,
+			  self, NULL);
+
+
+  /* add handler for batched requests */
+  soup_server_add_handler(self->priv->server, "/batch",
+			  cio_batch_request_handler,
+			  self, NULL);
 
   /* add handler for providers */
   soup_server_add_handler(self->priv->server, "/providers",
@@ -623,10 +824,7 @@ _service_initialize_handler(cio_service_t *self)
     g_assert(provider != NULL);
 
     /* register plugin web api handlers */
-    g_snprintf(path, sizeof(path), "/providers/%s", provider->id);
-    soup_server_add_handler(self->priv->server, path,
-			    cio_provider_request_handler,
-			    self, NULL);
+    _service_provider_handler(self, provider);
 
     item = g_list_next(item);
   }
@@ -656,6 +854,18 @@ _service_auth_domain_handler(SoupAuthDomain *domain, SoupMessage *msg,
   return digest;
 }
 
+/** filter of auth domain, sub-requests of a batch are already
+    authenticated */
+static gboolean
+_service_auth_domain_filter(SoupAuthDomain *domain, SoupMessage *msg,
+			    gpointer user_data)
+{
+  cio_service_t *service;
+  service = (cio_service_t *)user_data;
+
+  return !cio_batch_authorized(service->batch, msg);
+}
+
 cio_service_t *
 cio_service_new()
 {
@@ -667,10 +877,12 @@ cio_service_new()
   service->priv = g_malloc(sizeof(cio_service_priv_t));
   memset(service->priv, 0, sizeof(cio_service_priv_t));
 
+  g_mutex_init(&service->priv->backlog_lock);
   g_log_set_default_handler(_service_log_handler, service);
 
-  service->providers = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)cio_provider_destroy);
+  service->providers = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)cio_provider_unref);
   service->priv->backlog = g_queue_new();
+  service->priv->generations = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 
   /* initialize soup cache for plugin http requests */
   service->cache = soup_cache_new(CASTIO_INSTALL_PREFIX"/var/cache/castio/http",
@@ -681,12 +893,41 @@ cio_service_new()
   /* initialize blobcache */
   service->blobcache = cio_blobcache_new();
 
+  /* initialize index of items seen from providers */
+  service->index = cio_index_new(CASTIO_INSTALL_PREFIX"/var/cache/castio/index");
+
   return service;
 }
 
 void
 cio_service_destroy(struct cio_service_t *self)
 {
+  GList *item;
+  _service_plugin_load_t *load;
+
+  /* drop plugins not yet loaded */
+  if (self->priv->monitor)
+  {
+    g_signal_handlers_disconnect_by_data(self->priv->monitor, self);
+    g_file_monitor_cancel(self->priv->monitor);
+    g_object_unref(self->priv->monitor);
+  }
+
+  if (self->priv->loader)
+    g_thread_pool_free(self->priv->loader, TRUE, TRUE);
+
+  for (item = self->priv->loads; item; item = g_list_next(item))
+  {
+    load = item->data;
+    g_idle_remove_by_data(load);
+    if (load->provider)
+      cio_provider_unref(load->provider);
+    g_free(load->filename);
+    g_free(load);
+  }
+  g_list_free(self->priv->loads);
+  g_hash_table_destroy(self->priv->generations);
+
   g_object_unref(self->priv->server);
   g_object_unref(self->priv->domain);
 
@@ -696,9 +937,18 @@ cio_service_destroy(struct cio_service_t *self)
   if (self->search)
     cio_search_destroy(self->search);
 
+  if (self->suggest)
+    cio_suggest_destroy(self->suggest);
+
+  if (self->batch)
+    cio_batch_destroy(self->batch);
+
   if (self->blobcache)
     cio_blobcache_destroy(self->blobcache);
 
+  if (self->index)
+    cio_index_destroy(self->index);
+
   if (self->cache)
     g_object_unref(self->cache);
 
@@ -757,11 +1007,18 @@ cio_service_initialize(struct cio_service_t *self,
   _service_initialize_providers(self);
 
   /* intialize search */
-  self->search = cio_search_new();
+  self->search = cio_search_new(self);
+
+  /* initialize search suggestions */
+  self->suggest = cio_suggest_new(self);
+
+  /* initialize batched requests */
+  self->batch = cio_batch_new(self);
 
   /* initialize soup server */
   self->priv->domain = soup_auth_domain_digest_new(SOUP_AUTH_DOMAIN_REALM, AUTH_REALM, NULL);
   soup_auth_domain_digest_set_auth_callback(self->priv->domain, _service_auth_domain_handler, self, NULL);
+  soup_auth_domain_set_filter(self->priv->domain, _service_auth_domain_filter, self, NULL);
   soup_auth_domain_add_path(self->priv->domain, "/");
 
   self->priv->server = g_object_new(SOUP_TYPE_SERVER, NULL);
@@ -775,6 +1032,8 @@ cio_service_initialize(struct cio_service_t *self,
   soup_server_add_auth_domain(self->priv->server, self->priv->domain);
   g_signal_connect(self->priv->server, "request-read",
 		   G_CALLBACK(_service_request_read_handler), self);
+  g_signal_connect(self->priv->server, "request-started",
+		   G_CALLBACK(cio_batch_request_started), self);
 
   /* initialize service handler */
   _service_initialize_handler(self);
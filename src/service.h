@@ -29,7 +29,10 @@ typedef struct cio_service_t
   struct cio_service_priv_t *priv;
   struct cio_settings_t *settings;
   struct cio_search_t *search;
+  struct cio_suggest_t *suggest;
+  struct cio_batch_t *batch;
   struct cio_blobcache_t *blobcache;
+  struct cio_index_t *index;
   GHashTable *providers;
   SoupCache *cache;
 } cio_service_t;
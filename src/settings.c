@@ -20,6 +20,7 @@
 
 #include <string.h>
 #include "settings.h"
+#include "response.h"
 
 #define DOMAIN "settings"
 
@@ -27,6 +28,9 @@ typedef struct cio_settings_t
 {
   char *filename;
   JsonNode *root;
+
+  /* settings are read by providers running on worker threads */
+  GRecMutex lock;
 } cio_settings_t;
 
 static GQuark _quark;
@@ -154,6 +158,7 @@ cio_settings_new(const char *filename)
   memset(settings, 0, sizeof(cio_settings_t));
 
   settings->filename = g_strdup(filename);
+  g_rec_mutex_init(&settings->lock);
 
   if (!cio_settings_load(settings, &err))
   {
@@ -176,6 +181,7 @@ cio_settings_destroy(cio_settings_t *self)
 
   g_free(self->filename);
   json_node_free(self->root);
+  g_rec_mutex_clear(&self->lock);
   g_free(self);
 }
 
@@ -212,9 +218,12 @@ cio_settings_save(cio_settings_t *self, GError **err)
 
   gen = json_generator_new();
   json_generator_set_pretty(gen, TRUE);
-  json_generator_set_root(gen, self->root);
 
+  g_rec_mutex_lock(&self->lock);
+  json_generator_set_root(gen, self->root);
   json_generator_to_file(gen, self->filename, err);
+  g_rec_mutex_unlock(&self->lock);
+
   g_object_unref(gen);
   if (*err)
     return FALSE;
@@ -226,17 +235,23 @@ cio_settings_save(cio_settings_t *self, GError **err)
 gboolean
 cio_settings_has_section(cio_settings_t *self, const char *section)
 {
+  gboolean res;
   JsonObject *object;
+
+  g_rec_mutex_lock(&self->lock);
   object = json_node_get_object(self->root);
   g_assert(object != NULL);
 
-  return json_object_has_member(object, section);
+  res = json_object_has_member(object, section);
+  g_rec_mutex_unlock(&self->lock);
+
+  return res;
 }
 
-gboolean
-cio_settings_update_section(struct cio_settings_t *self,
-			    const char *section,
-			    JsonNode *node)
+static gboolean
+_settings_update_section(struct cio_settings_t *self,
+			 const char *section,
+			 JsonNode *node)
 {
   GList *members;
   JsonObject *object;
@@ -361,11 +376,24 @@ cio_settings_update_section(struct cio_settings_t *self,
   return TRUE;
 }
 
-
 gboolean
-cio_settings_has_value(cio_settings_t *self,
-		       const char *section,
-		       const char *id)
+cio_settings_update_section(struct cio_settings_t *self,
+			    const char *section,
+			    JsonNode *node)
+{
+  gboolean res;
+
+  g_rec_mutex_lock(&self->lock);
+  res = _settings_update_section(self, section, node);
+  g_rec_mutex_unlock(&self->lock);
+
+  return res;
+}
+
+static gboolean
+_settings_has_value(cio_settings_t *self,
+		    const char *section,
+		    const char *id)
 {
   JsonObject *object, *settings;
 
@@ -382,11 +410,25 @@ cio_settings_has_value(cio_settings_t *self,
   return TRUE;
 }
 
-JsonNode *
-cio_settings_get_value(cio_settings_t *self,
-		       const gchar *section,
-		       const gchar *id,
-		       GError **err)
+gboolean
+cio_settings_has_value(cio_settings_t *self,
+		       const char *section,
+		       const char *id)
+{
+  gboolean res;
+
+  g_rec_mutex_lock(&self->lock);
+  res = _settings_has_value(self, section, id);
+  g_rec_mutex_unlock(&self->lock);
+
+  return res;
+}
+
+static JsonNode *
+_settings_get_value(cio_settings_t *self,
+		    const gchar *section,
+		    const gchar *id,
+		    GError **err)
 {
   JsonObject *object;
   JsonObject *settings;
@@ -412,14 +454,46 @@ cio_settings_get_value(cio_settings_t *self,
   return json_object_get_member(setting, "value");
 }
 
-gboolean
-cio_settings_create_value(cio_settings_t *self,
-			  const char *section,
-			  const char *id,
-			  const char *name,
-			  const char *description,
-			  JsonNode *value,
-			  GError **err)
+JsonNode *
+cio_settings_get_value(cio_settings_t *self,
+		       const gchar *section,
+		       const gchar *id,
+		       GError **err)
+{
+  JsonNode *node;
+
+  g_rec_mutex_lock(&self->lock);
+  node = _settings_get_value(self, section, id, err);
+  g_rec_mutex_unlock(&self->lock);
+
+  return node;
+}
+
+JsonNode *
+cio_settings_dup_value(cio_settings_t *self,
+		       const gchar *section,
+		       const gchar *id,
+		       GError **err)
+{
+  JsonNode *node;
+
+  g_rec_mutex_lock(&self->lock);
+  node = _settings_get_value(self, section, id, err);
+  if (node)
+    node = json_node_copy(node);
+  g_rec_mutex_unlock(&self->lock);
+
+  return node;
+}
+
+static gboolean
+_settings_create_value(cio_settings_t *self,
+		       const char *section,
+		       const char *id,
+		       const char *name,
+		       const char *description,
+		       JsonNode *value,
+		       GError **err)
 {
   JsonObject *object;
   JsonObject *settings;
@@ -464,18 +538,39 @@ cio_settings_create_value(cio_settings_t *self,
   return TRUE;
 }
 
+gboolean
+cio_settings_create_value(cio_settings_t *self,
+			  const char *section,
+			  const char *id,
+			  const char *name,
+			  const char *description,
+			  JsonNode *value,
+			  GError **err)
+{
+  gboolean res;
+
+  g_rec_mutex_lock(&self->lock);
+  res = _settings_create_value(self, section, id, name, description, value, err);
+  g_rec_mutex_unlock(&self->lock);
+
+  return res;
+}
+
 char *
 cio_settings_get_string_value(cio_settings_t *self,
 			      const char *section,
 			      const char *id,
 			      GError **err)
 {
+  gchar *value;
   JsonNode *node;
-  node = cio_settings_get_value(self, section, id, err);
-  if (node == NULL)
-    return NULL;
 
-  return json_node_dup_string(node);
+  g_rec_mutex_lock(&self->lock);
+  node = _settings_get_value(self, section, id, err);
+  value = node ? json_node_dup_string(node) : NULL;
+  g_rec_mutex_unlock(&self->lock);
+
+  return value;
 }
 
 int
@@ -484,12 +579,15 @@ cio_settings_get_int_value(cio_settings_t *self,
 			   const char *id,
 			   GError **err)
 {
+  gint value;
   JsonNode *node;
-  node = cio_settings_get_value(self, section, id, err);
-  if (node == NULL)
-    return 0;
 
-  return json_node_get_int(node);
+  g_rec_mutex_lock(&self->lock);
+  node = _settings_get_value(self, section, id, err);
+  value = node ? json_node_get_int(node) : 0;
+  g_rec_mutex_unlock(&self->lock);
+
+  return value;
 }
 
 gboolean
@@ -498,12 +596,15 @@ cio_settings_get_boolean_value(struct cio_settings_t *self,
 			       const char *id,
 			       GError **err)
 {
+  gboolean value;
   JsonNode *node;
-  node = cio_settings_get_value(self, section, id, err);
-  if (node == NULL)
-    return FALSE;
 
-  return json_node_get_boolean(node);
+  g_rec_mutex_lock(&self->lock);
+  node = _settings_get_value(self, section, id, err);
+  value = node ? json_node_get_boolean(node) : FALSE;
+  g_rec_mutex_unlock(&self->lock);
+
+  return value;
 }
 
 
@@ -512,12 +613,9 @@ void cio_settings_request_handler(SoupServer *server, SoupMessage *msg,
 				  SoupClientContext *client, gpointer user_data)
 {
   GError *err;
-  gsize length;
   const gchar *mime_type;
-  gchar *content;
   gchar **components;
   JsonParser *parser;
-  JsonGenerator *gen;
   JsonObject *object;
   JsonNode *node;
   cio_settings_t *settings;
@@ -553,23 +651,18 @@ void cio_settings_request_handler(SoupServer *server, SoupMessage *msg,
    */
   if (msg->method == SOUP_METHOD_GET)
   {
+    g_rec_mutex_lock(&settings->lock);
+
     /* get section node */
     object = json_node_get_object(settings->root);
     node = json_object_get_member(object, components[2]);
     g_assert(node != NULL);
 
-    /* generate json data out of settings */
-    gen = json_generator_new();
-    json_generator_set_pretty(gen, TRUE);
-    json_generator_set_root(gen, node);
-    content = json_generator_to_data(gen, &length);
-    g_object_unref(gen);
-
-    soup_message_set_response(msg,
-			      "application/json; charset=utf-8",
-			      SOUP_MEMORY_TAKE,
-			      content,
-			      length);
+    /* respond with a copy of section node */
+    node = json_node_copy(node);
+    g_rec_mutex_unlock(&settings->lock);
+
+    cio_response_json(server, msg, node, cio_response_pretty(query));
 
   }
 
@@ -49,6 +49,13 @@ JsonNode *cio_settings_get_value(struct cio_settings_t *self,
 				 const gchar *id,
 				 GError **err);
 
+/** get a copy of value that is safe to use from any thread, caller
+    frees the returned node */
+JsonNode *cio_settings_dup_value(struct cio_settings_t *self,
+				 const gchar *section,
+				 const gchar *id,
+				 GError **err);
+
 gboolean cio_settings_create_value(struct cio_settings_t *self,
 				   const char *section,
 				   const char *id,
@@ -0,0 +1,224 @@
+/*
+ * This file is part of cast.io
+ *
+ * Copyright 2014 Henrik Andersson <henrik.4e@gmail.com>
+ *
+ * cast.io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cast.io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cast.io.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+#include <json-glib/json-glib.h>
+
+#include "suggest.h"
+#include "service.h"
+#include "provider.h"
+#include "trie.h"
+#include "response.h"
+
+#define DOMAIN "suggest"
+
+/* maximum number of suggestions kept */
+#define SUGGEST_MAX_KEYS 50000
+
+/* maximum number of suggestions returned for a request */
+#define SUGGEST_MAX_LIMIT 50
+
+/* weights added each time a suggestion is seen */
+#define SUGGEST_WEIGHT_ITEM 1
+#define SUGGEST_WEIGHT_PROVIDER 5
+#define SUGGEST_WEIGHT_QUERY 10
+
+typedef struct cio_suggest_t
+{
+  cio_service_t *service;
+  struct cio_trie_t *trie;
+} cio_suggest_t;
+
+/** get text in lower case with whitespace collapsed as key */
+static gchar *
+_suggest_key(const gchar *text)
+{
+  gchar *lower;
+  const gchar *p;
+  GString *key;
+
+  lower = g_utf8_strdown(text, -1);
+  key = g_string_new(NULL);
+
+  for (p = g_strchug(lower); *p; p++)
+  {
+    if (!g_ascii_isspace(*p))
+      g_string_append_c(key, *p);
+    else if (key->len && key->str[key->len - 1] != ' ')
+      g_string_append_c(key, ' ');
+  }
+
+  g_free(lower);
+  return g_string_free(key, FALSE);
+}
+
+static void
+_suggest_add(cio_suggest_t *self, const gchar *text, guint weight)
+{
+  gchar *key;
+  gchar *value;
+
+  if (text == NULL)
+    return;
+
+  value = g_strstrip(g_strdup(text));
+  key = _suggest_key(value);
+
+  if (!cio_trie_add(self->trie, key, value, weight, SUGGEST_MAX_KEYS))
+    g_log(DOMAIN, G_LOG_LEVEL_DEBUG,
+	  "Suggestion '%s' not added.", value);
+
+  g_free(key);
+  g_free(value);
+}
+
+cio_suggest_t *
+cio_suggest_new(cio_service_t *service)
+{
+  GList *list, *item;
+  cio_suggest_t *suggest;
+  cio_provider_descriptor_t *provider;
+
+  suggest = g_malloc(sizeof(cio_suggest_t));
+  memset(suggest, 0, sizeof(cio_suggest_t));
+
+  suggest->service = service;
+  suggest->trie = cio_trie_new();
+
+  /* add names of loaded providers */
+  list = item = g_hash_table_get_values(service->providers);
+  while (item)
+  {
+    provider = item->data;
+    _suggest_add(suggest, provider->name, SUGGEST_WEIGHT_PROVIDER);
+    item = g_list_next(item);
+  }
+  g_list_free(list);
+
+  return suggest;
+}
+
+void
+cio_suggest_destroy(cio_suggest_t *self)
+{
+  cio_trie_destroy(self->trie);
+  g_free(self);
+}
+
+void
+cio_suggest_add_provider(cio_suggest_t *self, cio_provider_descriptor_t *provider)
+{
+  _suggest_add(self, provider->name, SUGGEST_WEIGHT_PROVIDER);
+}
+
+void
+cio_suggest_add_item(cio_suggest_t *self, JsonNode *item)
+{
+  JsonNode *node;
+  JsonObject *metadata;
+
+  if (item == NULL || !JSON_NODE_HOLDS_OBJECT(item))
+    return;
+
+  node = json_object_get_member(json_node_get_object(item), "metadata");
+  if (node == NULL || !JSON_NODE_HOLDS_OBJECT(node))
+    return;
+
+  metadata = json_node_get_object(node);
+  node = json_object_get_member(metadata, "title");
+  if (node == NULL || !JSON_NODE_HOLDS_VALUE(node)
+      || json_node_get_value_type(node) != G_TYPE_STRING)
+    return;
+
+  _suggest_add(self, json_node_get_string(node), SUGGEST_WEIGHT_ITEM);
+}
+
+void
+cio_suggest_add_title(cio_suggest_t *self, const gchar *title)
+{
+  if (title)
+    _suggest_add(self, title, SUGGEST_WEIGHT_ITEM);
+}
+
+void
+cio_suggest_add_query(cio_suggest_t *self, const gchar *keywords)
+{
+  _suggest_add(self, keywords, SUGGEST_WEIGHT_QUERY);
+}
+
+void
+cio_suggest_request_handler(SoupServer *server, SoupMessage *msg,
+			    const char *path, GHashTable *query,
+			    SoupClientContext *client, gpointer user_data)
+{
+  guint i;
+  gint64 limit;
+  gchar *prefix;
+  gchar *value;
+  GPtrArray *completions;
+  JsonArray *array;
+  JsonNode *node;
+  cio_service_t *service;
+
+  service = (cio_service_t *)user_data;
+
+  if (msg->method != SOUP_METHOD_GET)
+  {
+    soup_message_set_status(msg, SOUP_STATUS_METHOD_NOT_ALLOWED);
+    return;
+  }
+
+  if (g_strcmp0(path, "/suggest") != 0)
+  {
+    soup_message_set_status(msg, SOUP_STATUS_NOT_FOUND);
+    return;
+  }
+
+  value = query ? g_hash_table_lookup(query, "q") : NULL;
+  if (value == NULL)
+  {
+    g_log(DOMAIN, G_LOG_LEVEL_WARNING,
+	  "Suggest failed, no query specified in the request.");
+    soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+    return;
+  }
+
+  limit = 10;
+  if (g_hash_table_lookup(query, "limit"))
+    limit = g_ascii_strtoll(g_hash_table_lookup(query, "limit"), NULL, 10);
+  limit = CLAMP(limit, 1, SUGGEST_MAX_LIMIT);
+
+  /* lookup completions of the prefix */
+  prefix = _suggest_key(value);
+  completions = cio_trie_complete(service->suggest->trie, prefix, limit);
+  g_free(prefix);
+
+  array = json_array_new();
+  for (i = 0; i < completions->len; i++)
+    json_array_add_string_element(array, g_ptr_array_index(completions, i));
+  g_ptr_array_free(completions, TRUE);
+
+  node = json_node_alloc();
+  json_node_init_array(node, array);
+  json_array_unref(array);
+
+  cio_response_json(server, msg, node, cio_response_pretty(query));
+  soup_message_set_status(msg, SOUP_STATUS_OK);
+}
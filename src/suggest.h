@@ -0,0 +1,54 @@
+/*
+ * This file is part of cast.io
+ *
+ * Copyright 2014 Henrik Andersson <henrik.4e@gmail.com>
+ *
+ * cast.io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cast.io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cast.io.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _suggest_h
+#define _suggest_h
+
+#include <glib.h>
+#include <libsoup/soup.h>
+#include <json-glib/json-glib.h>
+
+struct cio_suggest_t;
+struct cio_service_t;
+struct cio_provider_descriptor_t;
+
+struct cio_suggest_t *cio_suggest_new(struct cio_service_t *service);
+
+void cio_suggest_destroy(struct cio_suggest_t *self);
+
+/** add the name of a provider loaded after the suggestions were
+    created */
+void cio_suggest_add_provider(struct cio_suggest_t *self,
+			      struct cio_provider_descriptor_t *provider);
+
+/** add the title of an item seen from a provider */
+void cio_suggest_add_item(struct cio_suggest_t *self, JsonNode *item);
+
+/** add the title of an item taken from a listing, NULL is ignored */
+void cio_suggest_add_title(struct cio_suggest_t *self, const gchar *title);
+
+/** add the keywords of a search which found items */
+void cio_suggest_add_query(struct cio_suggest_t *self, const gchar *keywords);
+
+void cio_suggest_request_handler(SoupServer *server, SoupMessage *msg,
+				 const char *path, GHashTable *query,
+				 SoupClientContext *client, gpointer user_data);
+
+#endif /* _suggest_h */
@@ -0,0 +1,330 @@
+/*
+ * This file is part of cast.io
+ *
+ * Copyright 2014 Henrik Andersson <henrik.4e@gmail.com>
+ *
+ * cast.io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cast.io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cast.io.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "trie.h"
+
+/* a node of the compressed trie, label is the part of the key on the
+   edge from the parent and weight is non zero if the node ends a key */
+typedef struct _trie_node_t
+{
+  gchar *label;
+  gchar *value;
+  guint weight;
+
+  /* highest weight of a key in this subtree */
+  guint best;
+
+  GPtrArray *children;
+} _trie_node_t;
+
+/* a subtree or a key to visit in the best first walk of completion */
+typedef struct _trie_candidate_t
+{
+  _trie_node_t *node;
+  gboolean key;
+  guint priority;
+} _trie_candidate_t;
+
+typedef struct cio_trie_t
+{
+  _trie_node_t *root;
+  guint size;
+} cio_trie_t;
+
+static _trie_node_t *
+_trie_node_new(const gchar *label, gsize length)
+{
+  _trie_node_t *node;
+  node = g_new0(_trie_node_t, 1);
+  node->label = g_strndup(label, length);
+  return node;
+}
+
+static void
+_trie_node_free(_trie_node_t *node)
+{
+  if (node->children)
+    g_ptr_array_free(node->children, TRUE);
+
+  g_free(node->label);
+  g_free(node->value);
+  g_free(node);
+}
+
+/** find the child which edge starts with c */
+static _trie_node_t *
+_trie_child(_trie_node_t *node, gchar c, guint *index)
+{
+  guint i;
+  _trie_node_t *child;
+
+  if (node->children == NULL)
+    return NULL;
+
+  for (i = 0; i < node->children->len; i++)
+  {
+    child = g_ptr_array_index(node->children, i);
+    if (child->label[0] == c)
+    {
+      if (index)
+	*index = i;
+      return child;
+    }
+  }
+
+  return NULL;
+}
+
+static gsize
+_trie_common(const gchar *a, const gchar *b)
+{
+  gsize n;
+  for (n = 0; a[n] && a[n] == b[n]; n++);
+  return n;
+}
+
+/** find the node ending key, NULL if key is not in trie */
+static _trie_node_t *
+_trie_lookup(cio_trie_t *self, const gchar *key)
+{
+  gsize n;
+  _trie_node_t *node;
+
+  node = self->root;
+  while (*key)
+  {
+    node = _trie_child(node, *key, NULL);
+    if (node == NULL)
+      return NULL;
+
+    n = _trie_common(node->label, key);
+    if (node->label[n] != '\0')
+      return NULL;
+
+    key += n;
+  }
+
+  return node->weight ? node : NULL;
+}
+
+static gint
+_trie_compare_candidates(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  const _trie_candidate_t *ca, *cb;
+
+  ca = (const _trie_candidate_t *)a;
+  cb = (const _trie_candidate_t *)b;
+
+  /* highest priority first and a key before a subtree of same priority */
+  if (ca->priority != cb->priority)
+    return ca->priority > cb->priority ? -1 : 1;
+
+  return cb->key - ca->key;
+}
+
+static void
+_trie_push_candidate(GSequence *queue, _trie_node_t *node, gboolean key)
+{
+  _trie_candidate_t *candidate;
+
+  candidate = g_new0(_trie_candidate_t, 1);
+  candidate->node = node;
+  candidate->key = key;
+  candidate->priority = key ? node->weight : node->best;
+  g_sequence_insert_sorted(queue, candidate, _trie_compare_candidates, NULL);
+}
+
+cio_trie_t *
+cio_trie_new()
+{
+  cio_trie_t *trie;
+
+  trie = g_malloc(sizeof(cio_trie_t));
+  memset(trie, 0, sizeof(cio_trie_t));
+
+  trie->root = _trie_node_new("", 0);
+
+  return trie;
+}
+
+static void
+_trie_free(_trie_node_t *node)
+{
+  guint i;
+
+  if (node->children)
+  {
+    for (i = 0; i < node->children->len; i++)
+      _trie_free(g_ptr_array_index(node->children, i));
+  }
+
+  _trie_node_free(node);
+}
+
+void
+cio_trie_destroy(cio_trie_t *self)
+{
+  _trie_free(self->root);
+  g_free(self);
+}
+
+guint
+cio_trie_size(cio_trie_t *self)
+{
+  return self->size;
+}
+
+gboolean
+cio_trie_add(cio_trie_t *self, const gchar *key, const gchar *value,
+	     guint weight, guint max_keys)
+{
+  guint i;
+  guint w;
+  gsize n;
+  gchar *tail;
+  const gchar *k;
+  _trie_node_t *node, *child, *mid;
+
+  if (*key == '\0' || weight == 0)
+    return FALSE;
+
+  if (self->size >= max_keys && _trie_lookup(self, key) == NULL)
+    return FALSE;
+
+  node = self->root;
+  k = key;
+  while (*k)
+  {
+    child = _trie_child(node, *k, &i);
+    if (child == NULL)
+    {
+      /* add rest of key as a new leaf */
+      child = _trie_node_new(k, strlen(k));
+      if (node->children == NULL)
+	node->children = g_ptr_array_new();
+      g_ptr_array_add(node->children, child);
+      node = child;
+      break;
+    }
+
+    n = _trie_common(child->label, k);
+    if (child->label[n] != '\0')
+    {
+      /* split edge at the end of the common part */
+      mid = _trie_node_new(child->label, n);
+      mid->best = child->best;
+      mid->children = g_ptr_array_new();
+      g_ptr_array_add(mid->children, child);
+
+      tail = g_strdup(child->label + n);
+      g_free(child->label);
+      child->label = tail;
+
+      node->children->pdata[i] = mid;
+      child = mid;
+    }
+
+    node = child;
+    k += n;
+  }
+
+  if (node->weight == 0)
+    self->size++;
+
+  node->weight += weight;
+  g_free(node->value);
+  node->value = g_strdup(value ? value : key);
+
+  /* propagate weight as best of subtrees on the path of key */
+  w = node->weight;
+  node = self->root;
+  node->best = MAX(node->best, w);
+  for (k = key; *k; k += strlen(node->label))
+  {
+    node = _trie_child(node, *k, NULL);
+    node->best = MAX(node->best, w);
+  }
+
+  return TRUE;
+}
+
+GPtrArray *
+cio_trie_complete(cio_trie_t *self, const gchar *prefix, guint limit)
+{
+  guint i;
+  gsize n;
+  GPtrArray *result;
+  GSequence *queue;
+  GSequenceIter *first;
+  _trie_candidate_t *candidate;
+  _trie_node_t *node;
+
+  result = g_ptr_array_new_with_free_func(g_free);
+
+  /* find the subtree of keys starting with prefix */
+  node = self->root;
+  while (*prefix)
+  {
+    node = _trie_child(node, *prefix, NULL);
+    if (node == NULL)
+      return result;
+
+    n = _trie_common(node->label, prefix);
+    if (prefix[n] == '\0')
+      break;
+
+    if (node->label[n] != '\0')
+      return result;
+
+    prefix += n;
+  }
+
+  /* best first walk of subtree, a candidate key is not taken before
+     all subtrees which could hold a better key are expanded */
+  queue = g_sequence_new(g_free);
+  _trie_push_candidate(queue, node, FALSE);
+
+  while (result->len < limit && g_sequence_get_length(queue) > 0)
+  {
+    first = g_sequence_get_begin_iter(queue);
+    candidate = g_sequence_get(first);
+    node = candidate->node;
+
+    if (candidate->key)
+      g_ptr_array_add(result, g_strdup(node->value));
+    else
+    {
+      /* expand subtree into its key and child subtrees */
+      if (node->weight)
+	_trie_push_candidate(queue, node, TRUE);
+
+      for (i = 0; node->children && i < node->children->len; i++)
+	_trie_push_candidate(queue, g_ptr_array_index(node->children, i), FALSE);
+    }
+
+    g_sequence_remove(first);
+  }
+
+  g_sequence_free(queue);
+  return result;
+}
@@ -0,0 +1,44 @@
+/*
+ * This file is part of cast.io
+ *
+ * Copyright 2014 Henrik Andersson <henrik.4e@gmail.com>
+ *
+ * cast.io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cast.io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cast.io.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _trie_h
+#define _trie_h
+
+#include <glib.h>
+
+struct cio_trie_t;
+
+struct cio_trie_t *cio_trie_new();
+void cio_trie_destroy(struct cio_trie_t *self);
+
+/** number of keys in the trie */
+guint cio_trie_size(struct cio_trie_t *self);
+
+/** add weight to key and set value as its completion text, returns
+    FALSE if key is new and the trie already holds max_keys keys */
+gboolean cio_trie_add(struct cio_trie_t *self, const gchar *key,
+		      const gchar *value, guint weight, guint max_keys);
+
+/** get completion texts of keys starting with prefix, highest weight
+    first, caller frees the returned array */
+GPtrArray *cio_trie_complete(struct cio_trie_t *self, const gchar *prefix,
+			     guint limit);
+
+#endif /* _trie_h */